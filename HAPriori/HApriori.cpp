@@ -3,74 +3,122 @@
 #include <fstream>
 #include <set>
 #include <cmath>
+#include <map>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
 
 #include <gimlet/json_parser.hpp>
 #include <gimlet/data_iterator.hpp>
 #include <gimlet/itemsets.hpp>
 #include "apriori.hpp"
 
-#define TMP_DATA_FILE "tmp.json"
-
 using namespace gimlet;
 using namespace gimlet::itemsets;
 
-template<typename Data>
+// Entropies of candidate patterns counted on the rows held in memory feature by feature. Partitions of
+// the rows are refined one feature at a time, their parts being numbered in the lexicographic order of
+// their values, and the partition of the prefix shared by consecutive candidates is computed once.
 class Scorer {
-  using data_type = Data;
-  using format_type = Data;
+  using code_type = unsigned short;
+  using column_type = std::vector<code_type>;
+  using part_type = std::uint32_t;
+  // Code of the rows without value for a feature, after every value
+  static constexpr code_type missing = std::numeric_limits<attribute_value_type>::max() + 1;
 
-  using map_type = sequence_mat_t<valued_varset_type, size_t>;
-  using value_type = typename map_type::value_type;
-  
-  std::string fileName_;
   size_t n_;
-  map_type map_;
-				  
-  void process(const data_type& data, const varset_type& pattern) {
-    valued_varset_type values;
-    auto varIt = pattern.begin(), varEnd = pattern.end();
-    auto dataIt = data.begin(), dataEnd = data.end();
-    
-    for(; varIt != varEnd; ++varIt) {
-      for(; dataIt != dataEnd; ++dataIt) {
-	if(std::get<0>(*dataIt) >= *varIt) break;
+  std::map<attribute_type, column_type> columns_;
+  std::map<attribute_type, size_t> widths_; // number of codes of every feature
+  bool cached_;
+  varset_type prefix_;
+  std::vector<part_type> prefixParts_, parts_, buffer_;
+  size_t nPrefixParts_;
+  std::vector<part_type> keys_;
+  std::vector<std::uint64_t> sortedKeys_;
+  std::vector<size_t> counts_; // sizes of the parts of the last refinement
+
+  // Refine the partition into nParts parts by the feature var, returning the number of parts of the result
+  size_t refine(const std::vector<part_type>& parts, size_t nParts, attribute_type var, std::vector<part_type>& refined) {
+    const column_type& column = columns_.at(var);
+    const std::uint64_t width = widths_.at(var);
+    const std::uint64_t nKeys = nParts * width;
+    refined.resize(n_);
+    counts_.clear();
+    if(nKeys <= std::max<std::uint64_t>(4 * n_, 1 << 16)) {
+      // Count every pair of a part and a value, then number the pairs met in their order
+      keys_.assign(nKeys, 0);
+      for(size_t row = 0; row != n_; ++row)
+	++keys_[parts[row] * width + column[row]];
+      for(std::uint64_t key = 0; key != nKeys; ++key)
+	if(keys_[key]) {
+	  counts_.push_back(keys_[key]);
+	  keys_[key] = counts_.size() - 1;
+	}
+      for(size_t row = 0; row != n_; ++row)
+	refined[row] = keys_[parts[row] * width + column[row]];
+    } else {
+      // Too many pairs to count them densely: sort those of the rows
+      sortedKeys_.resize(n_);
+      for(size_t row = 0; row != n_; ++row)
+	sortedKeys_[row] = parts[row] * width + column[row];
+      std::vector<std::uint64_t> rowKeys(sortedKeys_);
+      std::sort(sortedKeys_.begin(), sortedKeys_.end());
+      auto last = std::unique(sortedKeys_.begin(), sortedKeys_.end());
+      counts_.assign(last - sortedKeys_.begin(), 0);
+      for(size_t row = 0; row != n_; ++row) {
+	refined[row] = std::lower_bound(sortedKeys_.begin(), last, rowKeys[row]) - sortedKeys_.begin();
+	++counts_[refined[row]];
       }
-      if((dataIt != dataEnd) && (std::get<0>(*dataIt) == *varIt)) {
-	values.push_back(*dataIt);
-      } else {
-      }	  
     }
-    if(values.size() == pattern.size()) {
-      ++map_[values];
-    } else {
-      map_[values] = 10E6;
+    return counts_.size();
+  }
+
+  void computePrefix(const varset_type& prefix) {
+    prefix_ = prefix;
+    prefixParts_.assign(n_, 0);
+    nPrefixParts_ = 1;
+    for(attribute_type var : prefix_) {
+      nPrefixParts_ = refine(prefixParts_, nPrefixParts_, var, buffer_);
+      std::swap(prefixParts_, buffer_);
     }
+    cached_ = true;
   }
-    
-  
+
 public:
-  Scorer(const std::string& fileName, size_t n) : fileName_(fileName), n_(n), map_() {}
+  Scorer() : n_(0), columns_(), widths_(), cached_(false), prefix_(), prefixParts_(), parts_(), buffer_(),
+	     nPrefixParts_(0), keys_(), sortedKeys_(), counts_() {}
+
+  void add(const valued_varset_type& row) {
+    for(const auto& pair : row) {
+      column_type& column = columns_[std::get<0>(pair)];
+      column.resize(n_, missing);
+      column.push_back(std::get<1>(pair));
+    }
+    ++n_;
+  }
+
+  // To be called once every row is added
+  void finish() {
+    for(auto& column : columns_) {
+      column.second.resize(n_, missing);
+      widths_[column.first] = *std::max_element(column.second.begin(), column.second.end()) + 1;
+    }
+    cached_ = false;
+  }
   
   template <typename Map> void operator()(Map& patterns) {
-    std::ifstream ifile(fileName_, std::ios::binary);
-    static auto JSON_parser = gimlet::make_JSON_parser<gimlet::flow<format_type>>();
-    auto input_stream = gimlet::make_input_data_stream(ifile, JSON_parser);
-    auto begin = gimlet::make_input_data_begin(input_stream);
-    auto end = gimlet::make_input_data_end(input_stream);
-
-    map_.clear();    
-    for(auto it = begin; it != end; ++it)
-      for(auto& pattern : patterns) process(*it, pattern.first);
-
-    for(auto& count : map_) {
-      const valued_varset_type& data = count.first;
-      varset_type varset;
-      for(auto& pair : data) varset.push_back(std::get<0>(pair));      
-      double p = double(count.second) / n_;
-      
-      patterns[varset] -= p * std::log2(p);
+    for(auto& pattern : patterns) {
+      const varset_type& vars = pattern.first;
+      varset_type prefix(vars.begin(), vars.end() - 1);
+      if(! cached_ || prefix != prefix_)
+	computePrefix(prefix);
+      refine(prefixParts_, nPrefixParts_, vars.back(), parts_);
+      for(size_t count : counts_) {
+	double p = double(count) / n_;
+	pattern.second -= p * std::log2(p);
+      }
     }
-    
   }
 };
 
@@ -115,6 +163,7 @@ int main(int argc, char *argv[]) {
 
     {
       
+      Scorer scorer;
       std::set<attribute_type> features;
       size_t n = 0;
       double htot = 0.;
@@ -127,17 +176,15 @@ int main(int argc, char *argv[]) {
 	auto input_stream = make_input_data_stream(*input, JSON_parser);
 	auto begin = make_input_data_begin(input_stream);
 	auto end = make_input_data_end(input_stream);
-	std::ofstream ofile(TMP_DATA_FILE, std::ios::binary);
 
-	auto output_stream = make_output_data_stream(ofile, JSON_parser);
-	auto out = gimlet::make_output_iterator(output_stream);
 	map_type values;
 	for(auto it = begin; it != end; ++it) {
 	  ++n;
 	  ++values[*it];
 	  for(auto& pair : *it) features.insert(std::get<0>(pair));
-	  *out++ = *it;
+	  scorer.add(*it);
 	}
+	scorer.finish();
 	for(auto& pair : values)
 	  htot -= double(pair.second) * std::log2(pair.second);
 	htot = htot / n + std::log2(n);
@@ -149,8 +196,7 @@ int main(int argc, char *argv[]) {
 
       double hmax = threshold * htot;
       *out++  = std::pair{varset_type{}, 0.};
-      
-      Scorer<valued_varset_type> scorer(TMP_DATA_FILE, n);
+
       auto selector = [hmax, &out] (const std::pair<varset_type, double>& pattern) {
 	if(pattern.second <= hmax) {
 	  *out++ = pattern;
@@ -2,12 +2,18 @@
 
 #include <gimlet/json_parser.hpp>
 #include <gimlet/data_iterator.hpp>
+#include <numeric>
+#include <unordered_map>
+#include <string_view>
+#include <array>
 
 namespace gimlet {	
   namespace itemsets {
+
+    FPTree::Constraints::Constraints() : included_(), excluded_(), minSize_(0), maxSize_(std::numeric_limits<size_t>::max()) {}
 	
-    FPTree::Node::Node(Node* parent, token_type count) : parent_(parent), count_(count),
-							 childMaster_(), childCount_() {}
+    FPTree::Node::Node(Node* parent, token_type count) : parent_(parent),
+							 childMaster_(), count_(count), childCount_() {}
 
     void FPTree::Node::setCount(token_type count) {
       count_ += count;
@@ -22,8 +28,8 @@ namespace gimlet {
       return next_ == nullptr;
     }
   	
-    FPTree::Level::Level() : Link(), count_(0) {}
-    FPTree::Level::Level(pair_type attr) : Link(), attr_(attr), count_(0) {}
+    FPTree::Level::Level() : Link(), count_(0), index_(0) {}
+    FPTree::Level::Level(pair_type attr) : Link(), attr_(attr), count_(0), index_(0) {}
 	
     FPTree::Level::iterator FPTree::Level::begin() { return iterator(next_); }
     FPTree::Level::iterator FPTree::Level::end() { return iterator(nullptr); }
@@ -37,6 +43,75 @@ namespace gimlet {
     }    
 
     bool FPTree::Level::empty() const { return next_ == nullptr; }
+
+    FPTree::Level::Chunk::Chunk(Node* begin) : begin_(begin), index_(), masters_(), heirs_(), counts_() {}
+
+    FPTree::Level::iterator FPTree::Level::begin(size_t i) { return iterator(chunks_[i].begin_); }
+    FPTree::Level::iterator FPTree::Level::end(size_t i) { return iterator(i + 1 == chunks_.size() ? nullptr : chunks_[i + 1].begin_); }
+
+    void FPTree::Level::skip(iterator it, iterator end) {
+      for(; it != end; ++it)
+	it->master_ = it->parent_->master_;
+    }
+
+    void FPTree::Level::intersect(std::vector<Node*>& parts) {
+      auto it = begin(), end = this->end();	  
+      for(; it != end; ++it) {
+	Node* node = *it;
+	Node* master = node->master_;
+	if(master->childMaster_ == nullptr) {
+	  parts.push_back(master);
+	  master->childMaster_ = node;
+	}
+	master->childCount_ += node->count_;
+	node->master_ = master->childMaster_;
+      }
+    }
+
+    void FPTree::Level::intersect(std::vector<Node*>& parts, cool::ThreadPool& threads) {
+      // The masters are shared by the chunks: each chunk first gathers its parts on its own, then the
+      // parts are merged in the order of the chunks so that the heirs and the order of the parts are
+      // those of a sequential intersection, and the nodes finally move to their heirs.
+      for(size_t i = 0; i != chunks_.size(); ++i)
+	threads.emplace_back([this, i]() {
+	    Chunk& chunk = chunks_[i];
+	    auto it = begin(i), end = this->end(i);
+	    for(; it != end; ++it) {
+	      Node* node = *it;
+	      auto res = chunk.index_.emplace(node->master_, chunk.masters_.size());
+	      if(res.second) {
+		chunk.masters_.push_back(node->master_);
+		chunk.heirs_.push_back(node);
+		chunk.counts_.push_back(0);
+	      }
+	      chunk.counts_[res.first->second] += node->count_;
+	    }
+	  });
+      threads.join();
+
+      for(Chunk& chunk : chunks_) {
+	for(size_t j = 0; j != chunk.masters_.size(); ++j) {
+	  Node* master = chunk.masters_[j];
+	  if(master->childMaster_ == nullptr) {
+	    parts.push_back(master);
+	    master->childMaster_ = chunk.heirs_[j];
+	  }
+	  master->childCount_ += chunk.counts_[j];
+	}
+	chunk.index_.clear();
+	chunk.masters_.clear();
+	chunk.heirs_.clear();
+	chunk.counts_.clear();
+      }
+
+      for(size_t i = 0; i != chunks_.size(); ++i)
+	threads.emplace_back([this, i]() {
+	    auto it = begin(i), end = this->end(i);
+	    for(; it != end; ++it)
+	      it->master_ = it->master_->childMaster_;
+	  });
+      threads.join();
+    }
       
     std::ostream& operator<<(std::ostream& os, const FPTree::Level& level) {
       os << '[' << attr_to_string(level.attr_) << ", " << level.count_ << "] |";
@@ -65,7 +140,7 @@ namespace gimlet {
       return os;
     }
 
-    FPTree::Group::Group(attribute_type var) : std::vector<Level*>(), var_(var), H_(0.) {}
+    FPTree::Group::Group(attribute_type var) : std::vector<Level*>(), var_(var), H_(0.), marginalH_(0.), required_(false), nParts_(0), nNodes_(0) {}
     
     void FPTree::Group::computeEntropyFromLevels() {
       H_ = 0.;
@@ -81,31 +156,32 @@ namespace gimlet {
       }
     }
 
-    void FPTree::Group::skip() {
+    void FPTree::Group::skip(cool::ThreadPool* threads) {
+      // The chunks of large levels are handed to the threads while the other levels are skipped here
+      bool parallel = false;
       for(Level* level : *this) {
-	auto it = level->begin(), end = level->end();	  
-	for(; it != end; ++it)
-	  it->master_ = it->parent_->master_;
+	if(threads != nullptr && ! level->chunks_.empty()) {
+	  for(size_t i = 0; i != level->chunks_.size(); ++i)
+	    threads->emplace_back([level, i]() { level->skip(level->begin(i), level->end(i)); });
+	  parallel = true;
+	} else
+	  level->skip(level->begin(), level->end());
       }
+      if(parallel)
+	threads->join();
     }
     
-    double FPTree::Group::intersect() {
+    double FPTree::Group::intersect(cool::ThreadPool* threads) {
       double H = 0.;
       count_type total = 0;
       static std::vector<Node*> parts;
 
+      nParts_ = 0;
       for(Level* level : *this) {
-	auto it = level->begin(), end = level->end();	  
-	for(; it != end; ++it) {
-	  Node* node = *it;
-	  Node* master = node->master_;
-	  if(master->childMaster_ == nullptr) {
-	    parts.push_back(master);
-	    master->childMaster_ = node;
-	  }
-	  master->childCount_ += node->count_;
-	  node->master_ = master->childMaster_;
-	}
+	if(threads != nullptr && ! level->chunks_.empty())
+	  level->intersect(parts, *threads);
+	else
+	  level->intersect(parts);
 	
 	for(Node* master : parts) {
 	  count_type c = master->childCount_;
@@ -114,6 +190,7 @@ namespace gimlet {
 	  master->childCount_ = 0;
 	  master->childMaster_ = nullptr;
 	}
+	nParts_ += parts.size();
 	parts.clear();
       }
 
@@ -131,11 +208,204 @@ namespace gimlet {
       return os;
     }
     
+    FPTree::Projection::Projection() : first_(0), depth_(0), total_(0) {}
+
+    bool FPTree::Projection::build(const FPTree& tree, size_t varIndex) {
+      static constexpr size_t maxTableSize = 1 << 24;
+      
+      const size_t width = tree.sortedGroups_.size() - varIndex;
+      const Group& last = *tree.sortedGroups_.back();
+      unsigned int maxCard = 0;
+      for(size_t i = varIndex + 1; i != tree.sortedGroups_.size(); ++i)
+	maxCard = std::max(maxCard, static_cast<unsigned int>(tree.sortedGroups_[i]->size()));
+      size_t nRows = 0;
+      for(const Level* level : last)
+	for(auto it = level->begin(); it != level->end(); ++it) ++nRows;
+      if(nRows * maxCard > maxTableSize) return false;
+      
+      // Every leaf is a distinct row whose path gives its values and, at the group of varIndex, its part
+      std::vector<unsigned int> rows(nRows * width);
+      std::vector<count_type> weights;
+      weights.reserve(nRows);
+      std::unordered_map<const Node*, unsigned int> partIds;
+      auto row = rows.begin();
+      for(const Level* level : last)
+	for(const Node* leaf : *level) {
+	  const Node* node = leaf;
+	  for(size_t k = width - 1; k != 0; --k) {
+	    row[k] = node->level_->index_;
+	    node = node->parent_;
+	  }
+	  row[0] = partIds.emplace(node->master_, partIds.size()).first->second;
+	  weights.push_back(leaf->count_);
+	  row += width;
+	}
+
+      // Rows only differing on the variables before varIndex are merged
+      std::vector<size_t> order(nRows);
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [&rows, width](size_t r1, size_t r2) {
+	  auto b1 = rows.begin() + r1 * width, b2 = rows.begin() + r2 * width;
+	  return std::lexicographical_compare(b1, b1 + width, b2, b2 + width);
+	});
+
+      first_ = varIndex + 1;
+      depth_ = 0;
+      total_ = tree.size_;
+      weights_.clear();
+      values_.resize(width - 1);
+      for(auto& values : values_) values.clear();
+      parts_.resize(1);
+      parts_[0].clear();
+      nParts_.assign(1, partIds.size());
+      cards_.clear();
+      for(size_t i = first_; i != tree.sortedGroups_.size(); ++i)
+	cards_.push_back(tree.sortedGroups_[i]->size());
+      
+      auto pred = rows.end();
+      for(size_t r : order) {
+	auto current = rows.begin() + r * width;
+	if(pred != rows.end() && std::equal(current, current + width, pred))
+	  weights_.back() += weights[r];
+	else {
+	  parts_[0].push_back(current[0]);
+	  for(size_t k = 1; k != width; ++k)
+	    values_[k - 1].push_back(current[k]);
+	  weights_.push_back(weights[r]);
+	}
+	pred = current;
+      }
+      return true;
+    }
+
+    double FPTree::Projection::refine(size_t varIndex) {
+      const std::vector<unsigned int>& values = values_[varIndex - first_];
+      const unsigned int card = cards_[varIndex - first_];
+      if(parts_.size() == depth_ + 1) {
+	parts_.emplace_back();
+	nParts_.push_back(0);
+      }
+      const std::vector<unsigned int>& parts = parts_[depth_];
+      std::vector<unsigned int>& refined = parts_[depth_ + 1];
+      refined.resize(weights_.size());
+      size_t tableSize = nParts_[depth_] * card;
+      if(table_.size() < tableSize) table_.resize(tableSize, none);
+
+      counts_.clear();
+      for(size_t r = 0; r != weights_.size(); ++r) {
+	unsigned int key = parts[r] * card + values[r];
+	unsigned int& id = table_[key];
+	if(id == none) {
+	  id = counts_.size();
+	  counts_.push_back(0);
+	  keys_.push_back(key);
+	}
+	counts_[id] += weights_[r];
+	refined[r] = id;
+      }
+      for(unsigned int key : keys_) table_[key] = none;
+      keys_.clear();
+      nParts_[depth_ + 1] = counts_.size();
+
+      double H = 0.;
+      for(count_type c : counts_) H -= c * std::log2(c);
+      return H / total_ + std::log2(total_);
+    }
+
+    void FPTree::Projection::push() { ++depth_; }
+    void FPTree::Projection::pop() { --depth_; }
+
+    FPTree::Bitmaps::Bitmaps(const std::vector<pattern_type>& data, const FPTree& tree) :
+      nWords_((data.size() + 63) / 64), depth_(0),
+      levels_(tree.sortedGroups_.size()),
+      parts_(1), sizes_(1), singletons_(1, 0) {
+      // The tree keeps the rows without a value for a variable in the partitions of its supersets
+      // in a way the bitmaps do not reproduce
+      for(const Group* group : tree.sortedGroups_) {
+	count_type total = 0;
+	for(const Level* level : *group) total += level->count_;
+	if(total != data.size())
+	  throw std::runtime_error("the bitmap engine requires a value for every variable in every row");
+	levels_[group->index_].assign(group->size() * nWords_, 0);
+      }
+      
+      for(size_t row = 0; row != data.size(); ++row) {
+	word_type bit = word_type(1) << (row % 64);
+	for(const pair_type& attr : data[row]) {
+	  const Group& group = tree.groups_.at(attr.first);
+	  levels_[group.index_][tree.levels_.at(attr).index_ * nWords_ + row / 64] |= bit;
+	}
+      }
+
+      std::vector<word_type>& all = parts_[0];
+      all.assign(nWords_, ~word_type(0));
+      if(data.size() % 64 != 0) all.back() = (word_type(1) << (data.size() % 64)) - 1;
+      sizes_[0].assign(data.empty() ? 0 : 1, data.size());
+    }
+
+    double FPTree::Bitmaps::refine(size_t varIndex) {
+      const std::vector<word_type>& levels = levels_[varIndex];
+      const size_t nLevels = levels.size() / nWords_;
+      if(parts_.size() == depth_ + 1) {
+	parts_.emplace_back();
+	sizes_.emplace_back();
+	singletons_.push_back(0);
+      }
+      const std::vector<count_type>& sizes = sizes_[depth_];
+      std::vector<count_type>& refinedSizes = sizes_[depth_ + 1];
+      std::vector<word_type>& refined = parts_[depth_ + 1];
+      refined.resize(sizes.size() * nLevels * nWords_);
+      refinedSizes.clear();
+
+      const word_type* part = parts_[depth_].data();
+      word_type* out = refined.data();
+      double H = 0.;
+      count_type singletons = singletons_[depth_], total = singletons;
+      for(count_type size : sizes) {
+	// Once the whole part is covered, the remaining levels cannot intersect it
+	count_type covered = 0;
+	for(size_t l = 0; l != nLevels && covered != size; ++l) {
+	  const word_type* level = &levels[l * nWords_];
+	  count_type c = 0;
+	  for(size_t w = 0; w != nWords_; ++w) {
+	    word_type bits = part[w] & level[w];
+	    out[w] = bits;
+	    c += __builtin_popcountll(bits);
+	  }
+	  if(c == 1) {
+	    ++singletons;
+	    ++total;
+	    ++covered;
+	  } else if(c != 0) {
+	    out += nWords_;
+	    refinedSizes.push_back(c);
+	    covered += c;
+	    H -= c * std::log2(c);
+	    total += c;
+	  }
+	}
+	part += nWords_;
+      }
+      singletons_[depth_ + 1] = singletons;
+
+      if(total != 0) {
+	H /= total;
+	H += std::log2(total);
+      }
+      return H;
+    }
+
+    void FPTree::Bitmaps::push() { ++depth_; }
+    void FPTree::Bitmaps::pop() { --depth_; }
+    
     FPTree::FPTree() :
       levels_(), groups_(),
-      pool_(new boost::object_pool<Node>()),
+      pool_(new boost::object_pool<Node>()), threads_(),
       size_(0), nbrNodes_(0),
-      root_(nullptr, 0) {
+      root_(nullptr, 0), complete_(false), denseThreshold_(0), nProjections_(0),
+      conditionalRatio_(0.), nConditionals_(0),
+      engine_(Engine::tree), bitmaps_(),
+      mergeEquivalent_(false), equivalences_() {
       root_.master_ = &root_;
       root_.level_ = nullptr;
     }
@@ -152,6 +422,170 @@ namespace gimlet {
       return groups_.size();
     }    
 
+    void FPTree::setDenseThreshold(size_t threshold) {
+      denseThreshold_ = threshold;
+    }
+
+    size_t FPTree::nProjections() {
+      return nProjections_;
+    }
+
+    void FPTree::setConditionalRatio(double ratio) {
+      conditionalRatio_ = ratio;
+    }
+
+    void FPTree::setParallelism(size_t nThreads, size_t chunkSize) {
+      threads_.reset(nThreads > 1 ? new cool::ThreadPool(nThreads) : nullptr);
+      for(auto& l : levels_) {
+	Level& level = l.second;
+	level.chunks_.clear();
+	if(! threads_ || chunkSize == 0) continue;
+	size_t n = 0;
+	for(auto it = level.begin(); it != level.end(); ++it, ++n)
+	  if(n % chunkSize == 0) level.chunks_.emplace_back(*it);
+	if(level.chunks_.size() == 1) level.chunks_.clear();
+      }
+    }
+
+    size_t FPTree::nConditionals() {
+      return nConditionals_;
+    }
+
+    const std::map<attribute_type, FPTree::Equivalence>& FPTree::equivalences() const {
+      return equivalences_;
+    }
+
+    void FPTree::mergeEquivalentVariables(std::vector<pattern_type>& data) {
+      // Only the variables with a value in every row are candidates. Their partition is encoded by
+      // labelling their values in order of first occurrence, so that equivalent variables get equal labels.
+      struct Column {
+	std::vector<attribute_value_type> labels_;
+	std::array<short, 256> valueLabels_;
+	short nLabels_;
+      };
+      std::map<attribute_type, Column> columns;
+      for(const auto& g : groups_) {
+	count_type total = 0;
+	for(const Level* level : g.second) total += level->count_;
+	if(total != data.size() || constraints_.included_.count(g.first) != 0) continue;
+	Column& column = columns[g.first];
+	column.labels_.reserve(data.size());
+	column.valueLabels_.fill(-1);
+	column.nLabels_ = 0;
+      }
+      for(const pattern_type& pattern : data)
+	for(const pair_type& attr : pattern) {
+	  auto it = columns.find(attr.first);
+	  if(it == columns.end()) continue;
+	  Column& column = it->second;
+	  short& label = column.valueLabels_[attr.second];
+	  if(label < 0) label = column.nLabels_++;
+	  column.labels_.push_back(static_cast<attribute_value_type>(label));
+	}
+
+      // Candidates with the same fingerprint are compared exactly, the first of each class stands for it
+      std::unordered_map<size_t, std::vector<attribute_type>> representatives;
+      std::set<attribute_type> merged;
+      for(const auto& c : columns) {
+	const std::vector<attribute_value_type>& labels = c.second.labels_;
+	size_t hash = std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char*>(labels.data()), labels.size()));
+	std::vector<attribute_type>& reps = representatives[hash];
+	auto rep = std::find_if(reps.begin(), reps.end(), [&](attribute_type var) { return columns.at(var).labels_ == labels; });
+	if(rep == reps.end()) {
+	  reps.push_back(c.first);
+	  continue;
+	}
+	Equivalence& equivalence = equivalences_[*rep];
+	if(equivalence.vars_.empty()) equivalence.vars_.push_back(*rep);
+	equivalence.vars_.push_back(c.first);
+	merged.insert(c.first);
+      }
+      if(merged.empty()) return;
+
+      for(pattern_type& pattern : data)
+	pattern.erase(std::remove_if(pattern.begin(), pattern.end(),
+				     [&merged](const pair_type& attr) { return merged.count(attr.first) != 0; }),
+		      pattern.end());
+      for(attribute_type var : merged) {
+	Group& g = groups_.at(var);
+	sortedGroups_.erase(std::find(sortedGroups_.begin(), sortedGroups_.end(), &g));
+	for(const Level* level : g) levels_.erase(level->attr_);
+	groups_.erase(var);
+      }
+    }
+
+    void FPTree::countNodes() {
+      for(Group* group : sortedGroups_) {
+	group->nNodes_ = 0;
+	for(const Level* level : *group)
+	  for(auto it = level->begin(); it != level->end(); ++it) ++group->nNodes_;
+      }
+    }
+
+    FPTree::FPTree(const FPTree& tree, size_t varIndex) : FPTree() {
+      const size_t first = varIndex + 1, width = tree.sortedGroups_.size() - varIndex;
+      for(size_t i = first; i != tree.sortedGroups_.size(); ++i) {
+	const Group& parentGroup = *tree.sortedGroups_[i];
+	Group& g = group(parentGroup.var_);
+	g.H_ = parentGroup.H_;
+	g.marginalH_ = parentGroup.marginalH_;
+	g.required_ = parentGroup.required_;
+	g.index_ = i - first;
+	for(const Level* parentLevel : parentGroup)
+	  level(parentLevel->attr_).count_ = parentLevel->count_;
+      }
+      complete_ = true;
+      
+      // Every leaf is a distinct row whose path gives its levels and, at the group of varIndex, its part
+      std::vector<unsigned int> rows;
+      std::vector<count_type> weights;
+      std::unordered_map<const Node*, unsigned int> partIds;
+      const Group& last = *tree.sortedGroups_.back();
+      for(const Level* level : last)
+	for(const Node* leaf : *level) {
+	  size_t offset = rows.size();
+	  rows.resize(offset + width);
+	  const Node* node = leaf;
+	  for(size_t k = width - 1; k != 0; --k) {
+	    rows[offset + k] = node->level_->index_;
+	    node = node->parent_;
+	  }
+	  rows[offset] = partIds.emplace(node->master_, partIds.size()).first->second;
+	  weights.push_back(leaf->count_);
+	}
+
+      // Rows only differing on the variables before varIndex are merged into the same path
+      std::vector<size_t> order(weights.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [&rows, width](size_t r1, size_t r2) {
+	  auto b1 = rows.begin() + r1 * width, b2 = rows.begin() + r2 * width;
+	  return std::lexicographical_compare(b1, b1 + width, b2, b2 + width);
+	});
+
+      std::vector<Node*> path(width);
+      auto pred = rows.end();
+      for(size_t r : order) {
+	auto row = rows.begin() + r * width;
+	size_t common = 0;
+	if(pred != rows.end())
+	  while(common != width && row[common] == pred[common]) ++common;
+	for(size_t k = common; k != width; ++k) {
+	  if(k == 0) {
+	    Node* part = pool_->construct(&root_, 0);
+	    ++nbrNodes_;
+	    part->master_ = part;
+	    part->level_ = nullptr;
+	    path[0] = part;
+	  } else
+	    path[k] = addNode((*sortedGroups_[k - 1])[row[k]]->attr_, path[k - 1]);
+	}
+	path[width - 1]->setCount(weights[r]);
+	size_ += weights[r];
+	pred = row;
+      }
+      countNodes();
+    }
+
     class FPTree::Iterator {
       using pattern_type = std::vector<pair_type>;
     public:
@@ -246,6 +680,7 @@ namespace gimlet {
       Level& level = (res.first)->second;
       if(res.second) {
 	Group& g = group(attr.first);
+	level.index_ = g.size();
 	g.push_back(&level);
       }
       return level;
@@ -285,13 +720,35 @@ namespace gimlet {
       std::vector<const pattern_type*> dataRefs;
 
       {
-	for(const pattern_type& pattern : data) {
+	// Drop the excluded variables before recording the attributes
+	const std::set<attribute_type>& excluded = constraints_.excluded_;
+	for(pattern_type& pattern : data) {
+	  if(! excluded.empty())
+	    pattern.erase(std::remove_if(pattern.begin(), pattern.end(),
+					 [&excluded](const pair_type& attr) { return excluded.count(attr.first) != 0; }),
+			  pattern.end());
 	  dataRefs.push_back(&pattern);
 	  record(pattern.begin(), pattern.end());
 	}
+	if(mergeEquivalent_)
+	  mergeEquivalentVariables(data);
 	
-	for(auto& group : groups_)
+	for(auto& group : groups_) {
 	  group.second.computeEntropyFromLevels();
+	  group.second.marginalH_ = group.second.H_;
+	}
+	for(auto& equivalence : equivalences_)
+	  equivalence.second.H_ = groups_.at(equivalence.first).marginalH_;
+	// The sizes of patterns are only known once their merged variables are expanded
+	if(! equivalences_.empty())
+	  constraints_.minSize_ = 0;
+
+	for(attribute_type var : constraints_.included_) {
+	  auto it = groups_.find(var);
+	  if(it == groups_.end())
+	    throw std::runtime_error(std::string("unknown or excluded required variable ") + std::to_string(var));
+	  it->second.required_ = true;
+	}
 	
 	std::sort(sortedGroups_.begin(), sortedGroups_.end(), [](const Group* g1, const Group* g2) { return g1->H_ < g2->H_; });
       }
@@ -316,6 +773,26 @@ namespace gimlet {
 	for(pattern_type& pattern : data)
 	  for(auto& attr : pattern) attr.first = sortedGroups_[attr.first]->var_;
       }
+
+      if(engine_ == Engine::bitmap) {
+	bitmaps_.reset(new Bitmaps(data, *this));
+	size_ = data.size();
+	
+	// Entropy of the distinct rows, which are contiguous once sorted
+	totalEntropy_ = 0.;
+	if(nVars() == 0) return;
+	double H = 0.;
+	count_type c = 0;
+	for(auto it = dataRefs.begin(); it != dataRefs.end(); ++it) {
+	  ++c;
+	  if(it + 1 == dataRefs.end() || **(it + 1) != **it) {
+	    H -= c * std::log2(c);
+	    c = 0;
+	  }
+	}
+	totalEntropy_ = H / size_ + std::log2(size_);
+	return;
+      }
       
       pattern_type root;
       const pattern_type* pred = &root;
@@ -350,6 +827,16 @@ namespace gimlet {
 	size_ += count;
       }
 
+      countNodes();
+      totalEntropy_ = 0.;
+      if(nVars() == 0) return;
+      complete_ = true;
+      for(const Group* group : sortedGroups_) {
+	count_type total = 0;
+	for(const Level* level : *group) total += level->count_;
+	complete_ = complete_ && total == size_;
+      }
+
       Group* group = sortedGroups_[nVars()-1];
       double H = 0.;
       count_type c, total = 0;
@@ -364,13 +851,13 @@ namespace gimlet {
 
     double FPTree::totalEntropy() { return totalEntropy_; }
 
-    FPTree FPTree::build(std::istream& is) {
+    FPTree FPTree::build(std::istream& is, const Constraints& constraints, Engine engine, bool mergeEquivalent) {
       auto JSON_parser = gimlet::make_JSON_parser<flow<pattern_type>>();
       auto input_stream = gimlet::make_input_data_stream(is, JSON_parser);
       auto begin = gimlet::make_input_data_begin<decltype(input_stream), pattern_type>(input_stream);
       auto end = gimlet::make_input_data_end<decltype(input_stream), pattern_type>(input_stream);
       
-      return build(begin, end);
+      return build(begin, end, constraints, engine, mergeEquivalent);
     }
   }
 }
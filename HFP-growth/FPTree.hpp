@@ -3,10 +3,15 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>
+#include <limits>
 #include <memory>
 #include <utility>
+#include <cstdint>
 #include <type_traits>
 #include <boost/pool/object_pool.hpp>
+#include <unordered_map>
+#include "gimlet/thread_pool.hpp"
 
 #include <gimlet/itemsets.hpp>
 
@@ -25,12 +30,33 @@ namespace gimlet {
     }
     
     class FPTree {
-      using token_type = unsigned short;
+      using token_type = unsigned int;
 
     public:
       
       using count_type = unsigned long;    
       using pair_type = std::pair<attribute_type, attribute_value_type>;
+
+      // Constraints on the variables of the enumerated patterns
+      struct Constraints {
+	std::set<attribute_type> included_, excluded_;
+	size_t minSize_, maxSize_;
+
+	Constraints();
+      };
+
+      // Variables inducing the same partition of rows, all stood for by the first one
+      struct Equivalence {
+	std::vector<attribute_type> vars_; // in increasing order
+	double H_;
+      };
+
+      // Data structure on which partitions are refined
+      enum class Engine {
+	tree,  // levels of the FP-tree
+	bitmap // bitmaps of rows, for small datasets the tree hardly compresses
+      };
+
     private:
       using pattern_type = std::vector<pair_type>;
       
@@ -43,14 +69,15 @@ namespace gimlet {
       
       struct Level;
      
+      // The counts come last so that they share the same word
       struct Node : Link {
 	Node* parent_;
-	token_type count_;
 	Node* master_;
 	Level* level_;
 
 	Node* childMaster_;
-	count_type childCount_;
+	token_type count_;
+	token_type childCount_;
 	
 	Node(Node* parent, token_type count);
 	Node(const Node&) = default;
@@ -61,8 +88,20 @@ namespace gimlet {
       };
 
       struct Level : Link {
+	// Nodes of a large level processed by one task, with the parts of its nodes in order of first occurrence
+	struct Chunk {
+	  Node* begin_;
+	  std::unordered_map<Node*, size_t> index_; // index of every master in masters_
+	  std::vector<Node*> masters_, heirs_;
+	  std::vector<count_type> counts_;
+
+	  Chunk(Node* begin);
+	};
+	
 	pair_type attr_;
 	count_type count_;
+	unsigned int index_; // index of the level in its group
+	std::vector<Chunk> chunks_; // empty unless the level is large enough to be processed in parallel
 	
 	Level();
 	Level(pair_type attr);
@@ -108,27 +147,98 @@ namespace gimlet {
 
 	void push_back(Node* n);
 	bool empty() const;
+
+	// Nodes of the chunk of index i
+	iterator begin(size_t i);
+	iterator end(size_t i);
+	void skip(iterator begin, iterator end);
+	// Append the parts met by the nodes to parts, accumulate their sizes and move the nodes to their heirs
+	void intersect(std::vector<Node*>& parts);
+	void intersect(std::vector<Node*>& parts, cool::ThreadPool& threads);
       };
 
       struct Group : std::vector<Level*> {
 	attribute_type var_;
-	double H_;
+	double H_, marginalH_;
 	attribute_type index_;
+	bool required_;
+	size_t nParts_; // number of parts of the partition computed by the last intersection
+	size_t nNodes_;
 	Group(attribute_type var);
 
 	void computeEntropyFromLevels();
-	void skip();
-	double intersect();
+	// Levels split into chunks are processed by the given threads if any
+	void skip(cool::ThreadPool* threads);
+	double intersect(cool::ThreadPool* threads);
       };
 
       std::map<pair_type, Level> levels_;
       std::map<attribute_type, Group> groups_;
       std::vector<Group*> sortedGroups_;
       
+      // Rows projected on the variables following a given one, with the part of every row in the partition
+      // of the current pattern. Sub-searches below small partitions are finished on these dense arrays
+      // rather than by walking the tree levels.
+      class Projection {
+	static constexpr unsigned int none = std::numeric_limits<unsigned int>::max();
+	
+	size_t first_, depth_;
+	count_type total_;
+	std::vector<count_type> weights_;
+	std::vector<std::vector<unsigned int>> values_, parts_;
+	std::vector<unsigned int> cards_, nParts_, table_, keys_;
+	std::vector<count_type> counts_;
+
+      public:
+	Projection();
+
+	// Project the rows on the variables following varIndex, whose group has just been intersected.
+	// Returns false if the projection is too large to be worth it.
+	bool build(const FPTree& tree, size_t varIndex);
+	// Entropy of the current pattern extended with the variable of index varIndex
+	double refine(size_t varIndex);
+	// Make the partition computed by the last refinement the current one
+	void push();
+	void pop();
+      };
+
+      // One bitmap of rows per level. Partitions are refined by AND-ing the bitmaps of their parts
+      // with those of levels and counting the bits of the results. Every row must have a value for every variable.
+      class Bitmaps {
+	using word_type = std::uint64_t;
+	
+	size_t nWords_, depth_;
+	std::vector<std::vector<word_type>> levels_; // per variable, the bitmaps of its levels
+	std::vector<std::vector<word_type>> parts_;  // per depth, the bitmaps of the parts of the partition
+	std::vector<std::vector<count_type>> sizes_; // per depth, the sizes of the parts
+	// Per depth, the number of rows alone in their part. Since every row has a value for every variable,
+	// these parts cannot be split any more and are counted without being stored.
+	std::vector<count_type> singletons_;
+
+      public:
+	Bitmaps(const std::vector<pattern_type>& data, const FPTree& tree);
+
+	// Entropy of the current pattern extended with the variable of index varIndex
+	double refine(size_t varIndex);
+	// Make the partition computed by the last refinement the current one
+	void push();
+	void pop();
+      };
+      
       std::unique_ptr<boost::object_pool<Node>> pool_;
+      std::unique_ptr<cool::ThreadPool> threads_;
       size_t size_, nbrNodes_;
       Node root_;
       double totalEntropy_;
+      Constraints constraints_;
+      bool complete_; // whether every row has a value for every variable
+      size_t denseThreshold_, nProjections_;
+      double conditionalRatio_;
+      size_t nConditionals_;
+      Engine engine_;
+      std::unique_ptr<Bitmaps> bitmaps_;
+      bool mergeEquivalent_;
+      std::map<attribute_type, Equivalence> equivalences_;
       
       Group& group(attribute_type attr);
       Level& level(const pair_type& attr);
@@ -149,26 +259,60 @@ namespace gimlet {
       }
 
       void build(std::vector<pattern_type>& data);
+      void countNodes();
+      // Remove from the data every variable inducing the same partition of rows as a variable of smaller index
+      void mergeEquivalentVariables(std::vector<pattern_type>& data);
+
+      // Conditional tree of the rows projected on the variables following varIndex, whose group has
+      // just been intersected. Every row hangs below a node standing for its part in the current partition.
+      FPTree(const FPTree& tree, size_t varIndex);
 
     public:
+      // A step of the enumeration: the index of a variable in the search order and
+      // whether this variable belongs to the patterns being enumerated
+      struct Frame {
+	attribute_type index_;
+	bool included_;
+      };
+      // Position of the enumeration in the search space, from which it can be resumed
+      using position_type = std::vector<Frame>;
+      
       FPTree();
       FPTree(const FPTree&) = delete;
       FPTree(FPTree&&) = default;
 
       template<typename DataIterator>
-      static FPTree build(DataIterator begin, DataIterator end) {
+      static FPTree build(DataIterator begin, DataIterator end, const Constraints& constraints = Constraints(), Engine engine = Engine::tree,
+			  bool mergeEquivalent = false) {
 	std::vector<pattern_type> data;
 	for(auto it = begin; it != end; ++it) data.push_back(*it);
 	FPTree tree;
+	tree.constraints_ = constraints;
+	tree.engine_ = engine;
+	tree.mergeEquivalent_ = mergeEquivalent;
 	tree.build(data);
 	return tree;
       }
       
-      static FPTree build(std::istream&);
+      static FPTree build(std::istream&, const Constraints& constraints = Constraints(), Engine engine = Engine::tree,
+			  bool mergeEquivalent = false);
       size_t size();
       size_t nbrNodes();
       size_t nVars();
       double totalEntropy();
+      // Finish the sub-searches whose partition has at most threshold parts on dense arrays (0 to disable)
+      void setDenseThreshold(size_t threshold);
+      // Number of sub-searches finished on dense arrays
+      size_t nProjections();
+      // Run the sub-searches whose partition has at most ratio parts per node of the last intersected group
+      // on conditional trees (0 to disable)
+      void setConditionalRatio(double ratio);
+      // Number of conditional trees built
+      size_t nConditionals();
+      // Split the levels of more than chunkSize nodes into chunks processed by nThreads threads (1 to disable)
+      void setParallelism(size_t nThreads, size_t chunkSize);
+      // Classes of equivalent variables merged at build time, indexed by the variable standing for each of them
+      const std::map<attribute_type, Equivalence>& equivalences() const;
       void internalState(std::ostream& os);
 
       using const_iterator = Iterator;
@@ -180,56 +324,224 @@ namespace gimlet {
       friend std::ostream& operator<<(std::ostream&, const FPTree&);     
 
       template<typename Processor, typename Selector>
-      void generate(Processor& processor, const Selector& selector);
+      void generate(Processor& processor, const Selector& selector, const position_type& position = position_type());
     };
 
     template<typename Processor, typename Selector>
     class FPTree::PatternGenerator {
+      // Entropy of a pattern on the current branch and sum of the marginal entropies of its variables
+      struct Ancestor {
+	double H_, marginalSum_;
+      };
+      
       FPTree& tree_;
       Processor& processor_;
       Selector selector_;
+      std::vector<Ancestor> ancestors_;
+      position_type stack_;
+      const Constraints& constraints_;
+      size_t nRequired_;
+      // Conditional tree on which the frames above base_ are processed. The variable of index i in
+      // the search order is the one of index i - offset_ in this tree.
+      struct Conditional {
+	std::unique_ptr<FPTree> tree_;
+	size_t base_, offset_;
+      };
       
-      void develop(size_t varIndex) {
-	Group& group = *tree_.sortedGroups_[varIndex];
-	//tree_.internalState(std::cerr);
-	++varIndex;
-
-	group.skip();
-	if(varIndex != tree_.nVars()) {
-	  develop(varIndex);
-	  group.H_ = group.intersect();
-	  if(selector_(group.H_)) {
+      std::vector<Conditional> conditionals_;
+      Projection projection_;
+      size_t denseBase_; // size of the stack above which frames are processed on dense arrays
+
+      FPTree& current() {
+	return conditionals_.empty() ? tree_ : *conditionals_.back().tree_;
+      }
+
+      // Index of a variable of the search order in the current tree
+      size_t local(size_t varIndex) const {
+	return conditionals_.empty() ? varIndex : varIndex - conditionals_.back().offset_;
+      }
+
+      Group& group(size_t varIndex) {
+	return *current().sortedGroups_[local(varIndex)];
+      }
+
+      // Partitions of the frames above denseBase_ are refined on the bitmaps of the engine if any, else on the projection
+      double refine(size_t varIndex) {
+	return tree_.bitmaps_ ? tree_.bitmaps_->refine(varIndex) : projection_.refine(local(varIndex));
+      }
+
+      void push() {
+	if(tree_.bitmaps_) tree_.bitmaps_->push();
+	else projection_.push();
+      }
+
+      void pop() {
+	if(tree_.bitmaps_) tree_.bitmaps_->pop();
+	else projection_.pop();
+      }
+
+      // Size of the current pattern
+      size_t size() const {
+	return ancestors_.size() - 1;
+      }
+
+      // Whether the current pattern extended with group could satisfy the size and inclusion constraints
+      bool isExtensible(const Group& group) const {
+	size_t missing = constraints_.included_.size() - nRequired_ - group.required_;
+	return size() + 1 + missing <= constraints_.maxSize_;
+      }
+      
+      void emit(const Group& group) {
+	if(nRequired_ + group.required_ == constraints_.included_.size() && size() + 1 >= constraints_.minSize_) {
+	  const Ancestor& parent = ancestors_.back();
+	  processor_.emit(group.H_, parent.H_, group.marginalH_, parent.marginalSum_ + group.marginalH_);
+	}
+      }
+
+      // Mark the variable of the top frame as part of the current pattern
+      void include(const Group& group) {
+	ancestors_.push_back(Ancestor{group.H_, ancestors_.back().marginalSum_ + group.marginalH_});
+	nRequired_ += group.required_;
+	stack_.back().included_ = true;
+      }
+
+      void exclude(const Group& group) {
+	ancestors_.pop_back();
+	nRequired_ -= group.required_;
+	processor_.pop();
+      }
+
+      // Skip every variable from varIndex, stacking one frame per variable.
+      // Branches skipping a required variable are not explored.
+      void descend(size_t varIndex) {
+	bool dense = stack_.size() >= denseBase_;
+	for(; varIndex != tree_.nVars(); ++varIndex) {
+	  Group& group = this->group(varIndex);
+	  if(! dense) group.skip(tree_.threads_.get());
+	  stack_.push_back(Frame{static_cast<attribute_type>(varIndex), false});
+	  if(group.required_) break;
+	}
+      }
+
+      // Restore the partitions and the pattern of a position without emitting anything
+      void resume(const position_type& position) {
+	for(const Frame& frame : position) {
+	  if(frame.index_ >= tree_.nVars())
+	    throw std::runtime_error("invalid search position");
+	  Group& group = *tree_.sortedGroups_[frame.index_];
+	  bool dense = stack_.size() >= denseBase_;
+	  if(! dense) group.skip(tree_.threads_.get());
+	  stack_.push_back(Frame{frame.index_, false});
+	  if(frame.included_) {
+	    group.H_ = dense ? refine(frame.index_) : group.intersect(tree_.threads_.get());
+	    if(dense) push();
 	    processor_.push(group.var_);
-	    processor_.emit(group.H_);
-	    develop(varIndex);
-	    processor_.pop();
+	    include(group);
 	  }
-	} else {
-	  group.H_ = group.intersect();
-	  if(selector_(group.H_)) {
-	    processor_.push(group.var_);
-	    processor_.emit(group.H_);
-	    processor_.pop();
+	}
+      }
+
+      // Continue the sub-search below the group just intersected on dense arrays or on a conditional tree
+      // when the partition is small enough
+      void project(const Group& group, size_t varIndex) {
+	FPTree& tree = current();
+	if(! tree.complete_) return;
+	if(group.nParts_ <= tree_.denseThreshold_ && projection_.build(tree, local(varIndex))) {
+	  denseBase_ = stack_.size();
+	  ++tree_.nProjections_;
+	} else if(varIndex + 2 < tree_.nVars() && group.nParts_ <= tree_.conditionalRatio_ * group.nNodes_) {
+	  conditionals_.push_back(Conditional{std::unique_ptr<FPTree>(new FPTree(tree, local(varIndex))),
+		stack_.size(), varIndex + 1});
+	  ++tree_.nConditionals_;
+	}
+      }
+
+      // Report the branches left unexplored when the search is interrupted
+      void reportFrontiers() {
+	std::vector<attribute_type> pattern, candidates;
+	for(const Frame& frame : stack_) {
+	  pattern.push_back(tree_.sortedGroups_[frame.index_]->var_);
+	  if(! frame.included_) {
+	    candidates.clear();
+	    for(size_t i = frame.index_ + 1; i != tree_.nVars(); ++i)
+	      candidates.push_back(tree_.sortedGroups_[i]->var_);
+	    processor_.frontier(pattern, candidates);
+	    pattern.pop_back();
 	  }
 	}
       }
 
+      void run() {
+	while(! stack_.empty()) {
+	  if(! processor_.checkpoint(stack_)) {
+	    reportFrontiers();
+	    break;
+	  }
+	  while(! conditionals_.empty() && stack_.size() <= conditionals_.back().base_)
+	    conditionals_.pop_back();
+	  Frame& frame = stack_.back();
+	  Group& group = this->group(frame.index_);
+	  bool dense = stack_.size() > denseBase_;
+	  if(! frame.included_) {
+	    //tree_.internalState(std::cerr);
+	    if(isExtensible(group)) {
+	      group.H_ = dense ? refine(frame.index_) : group.intersect(tree_.threads_.get());
+	      if(selector_(group.H_)) {
+		size_t varIndex = frame.index_ + 1;
+		processor_.push(group.var_);
+		emit(group);
+		if(varIndex != tree_.nVars() && size() + 1 < constraints_.maxSize_) {
+		  include(group);
+		  if(dense)
+		    push();
+		  else
+		    project(group, frame.index_);
+		  descend(varIndex);
+		  continue;
+		}
+		processor_.pop();
+	      }
+	    }
+	  } else {
+	    exclude(group);
+	    if(dense)
+	      pop();
+	    else if(stack_.size() == denseBase_)
+	      denseBase_ = std::numeric_limits<size_t>::max();
+	  }
+	  stack_.pop_back();
+	}
+      }
+
     public:
       PatternGenerator(FPTree& tree, Processor& processor, const Selector& selector) :
 	tree_(tree),
 	processor_(processor),
-	selector_(selector) {}
+	selector_(selector),
+	ancestors_(), stack_(),
+	constraints_(tree.constraints_), nRequired_(0),
+	conditionals_(), projection_(), denseBase_(tree.bitmaps_ ? 0 : std::numeric_limits<size_t>::max()) {
+	ancestors_.reserve(tree.nVars() + 1);
+	stack_.reserve(tree.nVars());
+      }
 	
-      void generate() {
-	processor_.emit(0.);
-	develop(0);
+      void generate(const position_type& position) {
+	ancestors_.push_back(Ancestor{0., 0.});
+	if(position.empty()) {
+	  if(constraints_.included_.empty() && constraints_.minSize_ == 0)
+	    processor_.emit(0., 0., 0., 0.);
+	  if(constraints_.maxSize_ != 0)
+	    descend(0);
+	} else
+	  resume(position);
+	run();
       }
     };
 
     template<typename Processor, typename Selector>
-    void FPTree::generate(Processor& processor, const Selector& selector) {
+    void FPTree::generate(Processor& processor, const Selector& selector, const position_type& position) {
       PatternGenerator<Processor, Selector> generator{*this, processor, selector};
-      generator.generate();
+      generator.generate(position);
     }    
   }
 }
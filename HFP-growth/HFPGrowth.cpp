@@ -1,5 +1,12 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <map>
+#include <cstdint>
 #include "gimlet/timer.hpp"
 #include "HFPGrowth.hpp"
 
@@ -11,30 +18,131 @@ namespace gimlet {
 
     //    using count_type = FPTree::count_type;
     using pair_type = FPTree::pair_type;
+    using basic_output_format = tuple<list<attribute_type>, double>;
+    using measures_output_format = tuple<list<attribute_type>, double, list<double>>;
+    using frontier_format = tuple<list<attribute_type>, list<attribute_type>>;
+    using checkpoint_value_type = std::tuple<std::vector<std::pair<attribute_type, bool>>, std::vector<size_t>, long, unsigned int, double>;
     
+    template<typename OutputFormat>
     class HFPGrowth::PatternProcessor {
+      static constexpr bool withMeasures = std::is_same_v<OutputFormat, measures_output_format>;
       using pattern_type = std::vector<attribute_type>;
-      using output_format = tuple<list<attribute_type>, double>;
-      using parser_t = JSONParser<flow<output_format>>;
+      using parser_t = JSONParser<flow<OutputFormat>>;
       using stream_t = output_stream_t<parser_t>;
+      using value_type = std::conditional_t<withMeasures,
+					    std::tuple<pattern_type, double, std::vector<double>>,
+					    std::pair<pattern_type, double>>;
 	
+      std::ostream& outputStream_;
       stream_t outputDataStream_;
-      output_stream_iterator_t<stream_t> outputIt_;
+      output_stream_iterator_t<stream_t, value_type> outputIt_;
 
       pattern_type pattern_;
+      const std::map<attribute_type, FPTree::Equivalence>& equivalences_;
+      pattern_type expanded_;
       int backSymbols_, forwardSymbols_;
+      const std::vector<Measure>& measures_;
+      std::vector<double> values_;
+      
+      using frontier_stream_t = output_stream_t<JSONParser<flow<frontier_format>>>;
       
       Stats& stats_;
+      const HFPGrowth& settings_;
+      cool::Timer checkpointTimer_;
+      Checkpoint checkpoint_;
+      cool::Timer& timer_;
+      double elapsedTime_;
+      std::ofstream frontiersFile_;
+      std::unique_ptr<frontier_stream_t> frontiersStream_;
+
+      void saveCheckpoint(const FPTree::position_type& position) {
+	outputStream_.flush();
+	checkpoint_.position_ = position;
+	checkpoint_.outputOffset_ = outputStream_.tellp();
+	checkpoint_.nPatterns_ = stats_.nPatterns_;
+	checkpoint_.elapsedTime_ = elapsedTime_ + timer_.runningLength();
+	checkpoint_.write(settings_.checkpointFileName_);
+      }
+
+      void write(const pattern_type& pattern, double H, double mi, double tc) {
+	if constexpr(withMeasures) {
+	  for(size_t i = 0; i != measures_.size(); ++i)
+	    switch(measures_[i]) {
+	    case Measure::mutualInformation:
+	      values_[i] = mi;
+	      break;
+	    case Measure::totalCorrelation:
+	      values_[i] = tc;
+	      break;
+	    }
+	  *outputIt_++ = std::make_tuple(pattern, H, values_);
+	} else
+	  *outputIt_++ = std::make_pair(pattern, H);
+	++stats_.nPatterns_;
+      }
+
+      // Output every pattern obtained by replacing the merged variables from position i of the current pattern
+      // by non empty subsets of their equivalence class. Each additional equivalent variable adds its entropy
+      // to the total correlation and leaves the joint entropy unchanged.
+      void expand(size_t i, double H, double mi, double varH, double tc) {
+	if(i == pattern_.size()) {
+	  const FPTree::Constraints& constraints = settings_.constraints_;
+	  if(expanded_.size() >= constraints.minSize_ && expanded_.size() <= constraints.maxSize_)
+	    write(expanded_, H, mi, tc);
+	  return;
+	}
+	auto it = equivalences_.find(pattern_[i]);
+	if(it == equivalences_.end()) {
+	  expanded_.push_back(pattern_[i]);
+	  expand(i + 1, H, mi, varH, tc);
+	  expanded_.pop_back();
+	  return;
+	}
+	const std::vector<attribute_type>& vars = it->second.vars_;
+	if(vars.size() >= 64)
+	  throw std::runtime_error(std::string("too many variables equivalent to ") + std::to_string(vars.front()) + " to expand");
+	for(uint64_t subset = 1; subset != uint64_t(1) << vars.size(); ++subset) {
+	  size_t n = 0;
+	  for(size_t j = 0; j != vars.size(); ++j)
+	    if(subset >> j & 1) {
+	      expanded_.push_back(vars[j]);
+	      ++n;
+	    }
+	  // The last variable is determined by the other ones as soon as one of its equivalents is among them
+	  bool last = i + 1 == pattern_.size();
+	  expand(i + 1, H, last && n > 1 ? varH : mi, varH, tc + (n - 1) * it->second.H_);
+	  expanded_.resize(expanded_.size() - n);
+	}
+      }
       
     public:
-      PatternProcessor(std::ostream& outputStream, Stats& stats) :
-	outputDataStream_{outputStream, parser_t{}},	
+      PatternProcessor(std::ostream& outputStream, bool resume, const std::vector<Measure>& measures, Stats& stats,
+		       const HFPGrowth& settings, const Checkpoint& checkpoint, cool::Timer& timer, double elapsedTime,
+		       const std::map<attribute_type, FPTree::Equivalence>& equivalences) :
+	outputStream_(outputStream),
+	outputDataStream_{outputStream, parser_t{}, resume},
 	outputIt_{outputDataStream_},
-	stats_(stats) {}
+	equivalences_(equivalences),
+	expanded_(),
+	measures_(measures),
+	values_(measures.size()),
+	stats_(stats),
+	settings_(settings),
+	checkpointTimer_(settings.checkpointFileName_.empty() ? 0. : settings.checkpointInterval_),
+	checkpoint_(checkpoint),
+	timer_(timer),
+	elapsedTime_(elapsedTime),
+	frontiersFile_(), frontiersStream_() {
+	checkpointTimer_.start();
+      }
 
-      void emit(double H) {
-	*outputIt_++ = std::make_pair(pattern_, H);
-	++stats_.nPatterns_;
+      // H is the entropy of the current pattern X = Y + {v}, parentH the one of Y,
+      // varH the one of {v} and marginalSum the sum of the entropies of every variable of X
+      void emit(double H, double parentH, double varH, double marginalSum) {
+	if(equivalences_.empty())
+	  write(pattern_, H, parentH + varH - H, marginalSum - H);
+	else
+	  expand(0, H, parentH + varH - H, varH, marginalSum - H);
       }
 
       void push(attribute_type var) {
@@ -45,14 +153,141 @@ namespace gimlet {
 	pattern_.pop_back();
 	++backSymbols_;
       } 
+
+      // Called between two search steps: save the search state whenever the checkpoint interval has elapsed
+      // and return false to stop the search once a budget is exhausted
+      bool checkpoint(const FPTree::position_type& position) {
+	bool exhausted = (settings_.timeLimit_ > 0. && std::chrono::steady_clock::now() >= settings_.deadline_)
+	  || stats_.nPatterns_ >= settings_.maxPatterns_;
+	if(exhausted)
+	  stats_.truncated_ = 1;
+	if(! settings_.checkpointFileName_.empty() && (checkpointTimer_.top() || exhausted))
+	  saveCheckpoint(position);
+	return ! exhausted;
+      }
+
+      // Report a branch left unexplored by an interrupted search: the pattern
+      // and its supersets obtained by adding some of the candidate variables
+      void frontier(const pattern_type& pattern, const pattern_type& candidates) {
+	if(settings_.frontiersFileName_.empty()) return;
+	if(! frontiersStream_) {
+	  frontiersFile_.open(settings_.frontiersFileName_, std::ios::out | std::ios::binary);
+	  frontiersStream_ = std::make_unique<frontier_stream_t>(frontiersFile_);
+	}
+	*frontiersStream_ << std::make_pair(pattern, candidates);
+      }
     };
+
+    void HFPGrowth::Checkpoint::read(const std::string& fileName) {
+      std::ifstream file(fileName, std::ios::in | std::ios::binary);
+      if(! file.good())
+	throw std::runtime_error(std::string("cannot open checkpoint file ") + fileName);
+      checkpoint_value_type value;
+      make_JSON_parser<checkpoint_value_type>().read(file, value);
+      if(! file.good() || std::get<1>(value).size() != 3)
+	throw std::runtime_error(std::string("invalid checkpoint file ") + fileName);
+      
+      position_.clear();
+      for(const auto& frame : std::get<0>(value))
+	position_.push_back(FPTree::Frame{frame.first, frame.second});
+      nVars_ = std::get<1>(value)[0];
+      size_ = std::get<1>(value)[1];
+      nbrNodes_ = std::get<1>(value)[2];
+      outputOffset_ = std::get<2>(value);
+      nPatterns_ = std::get<3>(value);
+      elapsedTime_ = std::get<4>(value);
+    }
+
+    void HFPGrowth::Checkpoint::write(const std::string& fileName) const {
+      checkpoint_value_type value;
+      for(const FPTree::Frame& frame : position_)
+	std::get<0>(value).emplace_back(frame.index_, frame.included_);
+      std::get<1>(value) = { nVars_, size_, nbrNodes_ };
+      std::get<2>(value) = outputOffset_;
+      std::get<3>(value) = nPatterns_;
+      std::get<4>(value) = elapsedTime_;
+
+      // Write a temporary file first so that the previous checkpoint remains valid until replaced
+      std::string tmpFileName = fileName + ".tmp";
+      {
+	std::ofstream file(tmpFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	make_JSON_parser<checkpoint_value_type>().write(file, value);
+	file << std::endl;
+	if(! file.good())
+	  throw std::runtime_error(std::string("cannot write checkpoint file ") + tmpFileName);
+      }
+      if(std::rename(tmpFileName.c_str(), fileName.c_str()) != 0)
+	throw std::runtime_error(std::string("cannot replace checkpoint file ") + fileName);
+    }
+
+    std::vector<HFPGrowth::Measure> HFPGrowth::parseMeasures(const std::string& measures) {
+      std::vector<Measure> res;
+      std::istringstream iss(measures);
+      std::string name;
+      while(std::getline(iss, name, ',')) {
+	if(name == "mi") res.push_back(Measure::mutualInformation);
+	else if(name == "tc") res.push_back(Measure::totalCorrelation);
+	else if(! name.empty())
+	  throw std::runtime_error(std::string("unknown measure ") + name);
+      }
+      return res;
+    }
+
+    std::set<attribute_type> HFPGrowth::parseVariables(const std::string& variables) {
+      std::set<attribute_type> res;
+      std::istringstream iss(variables);
+      std::string name;
+      while(std::getline(iss, name, ','))
+	if(! name.empty())
+	  res.insert(static_cast<attribute_type>(std::stoul(name)));
+      return res;
+    }
+
+    FPTree::Engine HFPGrowth::parseEngine(const std::string& engine) {
+      if(engine == "tree") return FPTree::Engine::tree;
+      if(engine == "bitmap") return FPTree::Engine::bitmap;
+      throw std::runtime_error(std::string("unknown engine ") + engine);
+    }
+
+    template<typename OutputFormat>
+    void HFPGrowth::generate(FPTree& tree, double absoluteMaxEntropy, const std::vector<Measure>& measures,
+			     std::ostream& outputStream, cool::Timer& timer, const Checkpoint* resumed, double elapsedTime) {
+      auto selector = [threshold = absoluteMaxEntropy](double value) {
+	return value <= threshold;
+      };
+
+      Checkpoint checkpoint{};
+      checkpoint.nVars_ = tree.nVars();
+      checkpoint.size_ = tree.size();
+      checkpoint.nbrNodes_ = tree.nbrNodes();
+      
+      PatternProcessor<OutputFormat> processor{outputStream, resumed != nullptr, measures, stats_,
+	  *this, checkpoint, timer, elapsedTime, tree.equivalences()};
+      tree.generate(processor, selector, resumed ? resumed->position_ : FPTree::position_type());
+    }
     
     void HFPGrowth::operator()(
 			       double threshold,
+			       const std::vector<Measure>& measures,
 			       const std::string& inputFileName,
 			       const std::string& outputFileName,
-			       const std::string& statsFileName
+			       const std::string& statsFileName,
+			       const std::string& resumeFileName
 			       ) {
+      cool::Timer timer;
+      timer.start();
+      Checkpoint resumed{};
+      bool resume = ! resumeFileName.empty();
+      if(resume) {
+	if(outputFileName.empty())
+	  throw std::runtime_error("resuming a search requires an output file");
+	resumed.read(resumeFileName);
+      }
+      deadline_ = std::chrono::steady_clock::now()
+	+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeLimit_ - resumed.elapsedTime_));
+      if(! checkpointFileName_.empty() && outputFileName.empty())
+	throw std::runtime_error("checkpoints require an output file");
+      
       auto inputStream = std::ref(std::cin);
       std::ifstream inputFile;
       if(! inputFileName.empty()) {
@@ -62,7 +297,12 @@ namespace gimlet {
       auto outputStream = std::ref(std::cout);
       std::ofstream outputFile;
       if(! outputFileName.empty()) {
-	outputFile.open(outputFileName, std::ios::out | std::ios::binary);
+	if(resume) {
+	  // Drop the patterns output after the checkpoint since they will be generated again
+	  std::filesystem::resize_file(outputFileName, resumed.outputOffset_);
+	  outputFile.open(outputFileName, std::ios::out | std::ios::app | std::ios::binary);
+	} else
+	  outputFile.open(outputFileName, std::ios::out | std::ios::binary);
 	outputStream = outputFile;
       }
       
@@ -70,24 +310,74 @@ namespace gimlet {
       if(! statsFileName.empty())
 	stats_.open(statsFileName.c_str(), "%");
       
-      cool::Timer timer;
-      timer.start();
-
-      FPTree tree = FPTree::build(inputStream);
+      FPTree tree = FPTree::build(inputStream, constraints_, engine_, mergeEquivalent_);
+      stats_.nMerged_ = 0;
+      for(const auto& equivalence : tree.equivalences())
+	stats_.nMerged_ += equivalence.second.vars_.size() - 1;
+      tree.setDenseThreshold(denseThreshold_);
+      tree.setConditionalRatio(conditionalRatio_);
+      tree.setParallelism(nThreads_, chunkSize_);
+      if(resume) {
+	if(resumed.nVars_ != tree.nVars() || resumed.size_ != tree.size() || resumed.nbrNodes_ != tree.nbrNodes())
+	  throw std::runtime_error("checkpoint does not match the input data");
+	stats_.nPatterns_ = resumed.nPatterns_;
+      }
       
-      double absoluteMaxEntropy = tree.totalEntropy() * threshold;	
-      auto selector = [threshold = absoluteMaxEntropy](double value) {
-	return value <= threshold;
-      };
-
-      PatternProcessor processor{outputStream, stats_};	
-      tree.generate(processor, selector);
+      double absoluteMaxEntropy = tree.totalEntropy() * threshold;
+      const Checkpoint* resumedPtr = resume ? &resumed : nullptr;
+      if(measures.empty())
+	generate<basic_output_format>(tree, absoluteMaxEntropy, measures, outputStream, timer, resumedPtr, resumed.elapsedTime_);
+      else
+	generate<measures_output_format>(tree, absoluteMaxEntropy, measures, outputStream, timer, resumedPtr, resumed.elapsedTime_);
       outputFile.close();
+      stats_.nProjections_ = tree.nProjections();
+      stats_.nConditionals_ = tree.nConditionals();
+      if(! checkpointFileName_.empty() && ! stats_.truncated_)
+	std::remove(checkpointFileName_.c_str());
       
-      stats_.totalTime_ = timer.stop();
+      stats_.totalTime_ = resumed.elapsedTime_ + timer.stop();
       stats_.write();
     }
 
-    HFPGrowth::HFPGrowth() : stats_{} {}
+    void HFPGrowth::setCheckpoint(const std::string& fileName, double interval) {
+      checkpointFileName_ = fileName;
+      checkpointInterval_ = interval;
+    }
+
+    void HFPGrowth::setBudget(double timeLimit, size_t maxPatterns, const std::string& frontiersFileName) {
+      timeLimit_ = timeLimit;
+      maxPatterns_ = maxPatterns;
+      frontiersFileName_ = frontiersFileName;
+    }
+
+    void HFPGrowth::setConstraints(const FPTree::Constraints& constraints) {
+      constraints_ = constraints;
+    }
+
+    void HFPGrowth::setDenseThreshold(size_t threshold) {
+      denseThreshold_ = threshold;
+    }
+
+    void HFPGrowth::setConditionalRatio(double ratio) {
+      conditionalRatio_ = ratio;
+    }
+
+    void HFPGrowth::setEngine(FPTree::Engine engine) {
+      engine_ = engine;
+    }
+
+    void HFPGrowth::setMergeEquivalent(bool merge) {
+      mergeEquivalent_ = merge;
+    }
+
+    void HFPGrowth::setParallelism(size_t nThreads, size_t chunkSize) {
+      nThreads_ = nThreads;
+      chunkSize_ = chunkSize;
+    }
+
+    HFPGrowth::HFPGrowth() : stats_{}, checkpointFileName_(), checkpointInterval_(0.),
+			     timeLimit_(0.), deadline_(), maxPatterns_(std::numeric_limits<size_t>::max()), frontiersFileName_(),
+			     constraints_(), denseThreshold_(0), conditionalRatio_(0.), engine_(FPTree::Engine::tree),
+			     mergeEquivalent_(false), nThreads_(1), chunkSize_(0) {}
   }
 }
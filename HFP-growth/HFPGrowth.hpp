@@ -1,33 +1,115 @@
 #pragma once
 
+#include <string>
+#include <vector>
+#include <set>
+#include <chrono>
 #include "gimlet/statistics.hpp"
+#include "gimlet/timer.hpp"
 #include "FPTree.hpp"
 
 namespace gimlet {
   namespace itemsets {
     class HFPGrowth {
+    public:
+      // Optional measures computed alongside the entropy of every pattern
+      enum class Measure {
+	mutualInformation, // mutual information between the last variable and the other ones
+	totalCorrelation   // total correlation of the pattern variables
+      };
+      
+      static std::vector<Measure> parseMeasures(const std::string& measures);
+      static std::set<attribute_type> parseVariables(const std::string& variables);
+      static FPTree::Engine parseEngine(const std::string& engine);
+      
+    private:
+      template<typename OutputFormat>
       class PatternProcessor;
       
       struct Stats : cool::Statistics {
 	unsigned int nPatterns_;
 	double totalTime_;
 	double relativeMaxEntropy_;
+	unsigned int truncated_;
+	unsigned int nProjections_;
+	unsigned int nConditionals_;
+	unsigned int nMerged_;
 
 	Stats() : Statistics() {
 	  addDouble("threshold", relativeMaxEntropy_);
 	  addDouble("total time", totalTime_, "s");
 	  addInteger("patterns", nPatterns_);
+	  addInteger("truncated", truncated_);
+	  addInteger("dense searches", nProjections_);
+	  addInteger("conditional trees", nConditionals_);
+	  addInteger("merged variables", nMerged_);
 	}
       };
       
+      // State of an interrupted search from which it can be resumed
+      struct Checkpoint {
+	FPTree::position_type position_;
+	size_t nVars_, size_, nbrNodes_;
+	long outputOffset_;
+	unsigned int nPatterns_;
+	double elapsedTime_;
+
+	void read(const std::string& fileName);
+	void write(const std::string& fileName) const;
+      };
+      
       Stats stats_;
+      std::string checkpointFileName_;
+      double checkpointInterval_;
+      double timeLimit_;
+      std::chrono::steady_clock::time_point deadline_; // end of the time limit, counting the time of the resumed runs
+      size_t maxPatterns_;
+      std::string frontiersFileName_;
+      FPTree::Constraints constraints_;
+      size_t denseThreshold_;
+      double conditionalRatio_;
+      FPTree::Engine engine_;
+      bool mergeEquivalent_;
+      size_t nThreads_, chunkSize_;
+
+      template<typename OutputFormat>
+      void generate(FPTree& tree, double absoluteMaxEntropy, const std::vector<Measure>& measures,
+		    std::ostream& outputStream, cool::Timer& timer, const Checkpoint* resumed, double elapsedTime);
       
     public:
       void operator()(
 	      double threshold,
+	      const std::vector<Measure>& measures,
 	      const std::string& inputFileName,
 	      const std::string& outputFileName,
-	      const std::string& statsFileName);
+	      const std::string& statsFileName,
+	      const std::string& resumeFileName);
+
+      // Periodically save the search state every interval seconds into the given file
+      void setCheckpoint(const std::string& fileName, double interval);
+
+      // Stop the search once timeLimit seconds have elapsed since the start of the run, resumed runs included
+      // (0 for no limit), or maxPatterns patterns are output.
+      // The branches left unexplored are then written into the frontiers file if any.
+      void setBudget(double timeLimit, size_t maxPatterns, const std::string& frontiersFileName);
+
+      // Restrict the enumerated patterns to those satisfying the given constraints
+      void setConstraints(const FPTree::Constraints& constraints);
+
+      // Finish the sub-searches whose partition has at most threshold parts on dense arrays (0 to disable)
+      void setDenseThreshold(size_t threshold);
+
+      // Run the sub-searches whose partition has at most ratio parts per tree node on conditional trees (0 to disable)
+      void setConditionalRatio(double ratio);
+
+      // Select the data structure on which partitions are refined
+      void setEngine(FPTree::Engine engine);
+
+      // Search once for all the variables inducing the same partition of rows, which are expanded back in the output
+      void setMergeEquivalent(bool merge);
+
+      // Skip and intersect the levels of more than chunkSize nodes by chunks on nThreads threads (1 to disable)
+      void setParallelism(size_t nThreads, size_t chunkSize);
 
       HFPGrowth();
     };
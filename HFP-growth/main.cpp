@@ -1,13 +1,20 @@
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <thread>
+#include <limits>
 #include "HFPGrowth.hpp"
 
 int main(int argc, char *argv[]) {
   using namespace gimlet::itemsets;
   try {
     HFPGrowth hfpgrowth;
-    std::string inputFileName, outputFileName, statsFileName;
+    FPTree::Constraints constraints;
+    std::string inputFileName, outputFileName, statsFileName, measures, checkpointFileName, resumeFileName, frontiersFileName, included, excluded, engine;
+    double checkpointInterval, timeLimit, conditionalRatio;
+    size_t maxPatterns, denseThreshold, chunkSize;
+    size_t nThreads = std::thread::hardware_concurrency();
     double threshold;
+    bool mergeEquivalent;
 
     {
       namespace po = boost::program_options;
@@ -15,9 +22,26 @@ int main(int argc, char *argv[]) {
       desc.add_options()
 	("help", "help message")
 	("hmax", po::value<double>(&threshold)->required(), "relative entropy maximum threshold")
+	("measures", po::value<std::string>(&measures), "comma separated list of extra measures to output (mi: mutual information between the last variable and the other ones, tc: total correlation)")
 	("input", po::value<std::string>(&inputFileName), "input filename")
 	("output", po::value<std::string>(&outputFileName), "output filename")
-	("stats", po::value<std::string>(&statsFileName), "statistics filename");
+	("stats", po::value<std::string>(&statsFileName), "statistics filename")
+	("checkpoint", po::value<std::string>(&checkpointFileName), "checkpoint filename where the search state is periodically saved (requires an output file)")
+	("checkpoint-interval", po::value<double>(&checkpointInterval)->default_value(600.), "time interval in seconds between two checkpoints")
+	("resume", po::value<std::string>(&resumeFileName), "checkpoint filename from which an interrupted search is resumed")
+	("time-limit", po::value<double>(&timeLimit)->default_value(0.), "time limit in seconds from the start of the run, resumed runs included, after which the search stops (0 for no limit)")
+	("max-patterns", po::value<size_t>(&maxPatterns)->default_value(std::numeric_limits<size_t>::max(), "none"), "number of output patterns after which the search stops")
+	("frontiers", po::value<std::string>(&frontiersFileName), "filename where the branches left unexplored by a stopped search are written")
+	("include", po::value<std::string>(&included), "comma separated list of variables every pattern must contain")
+	("exclude", po::value<std::string>(&excluded), "comma separated list of variables removed from the data")
+	("min-size", po::value<size_t>(&constraints.minSize_), "minimum number of variables of patterns")
+	("max-size", po::value<size_t>(&constraints.maxSize_), "maximum number of variables of patterns")
+	("dense-threshold", po::value<size_t>(&denseThreshold)->default_value(64), "number of parts of a partition below which its sub-search is finished on dense arrays (0 to disable)")
+	("conditional-ratio", po::value<double>(&conditionalRatio)->default_value(0.), "number of parts of a partition per node of the tree below which its sub-search runs on a conditional tree (0 to disable)")
+	("engine", po::value<std::string>(&engine)->default_value("tree"), "data structure on which partitions are refined (tree: FP-tree, bitmap: bitmaps of rows, for small datasets)")
+	("threads", po::value<size_t>(&nThreads), "number of threads skipping and intersecting the large levels of the tree")
+	("chunk-size", po::value<size_t>(&chunkSize)->default_value(1 << 16), "number of nodes of a level above which it is processed by chunks in parallel")
+	("merge-equivalent", po::bool_switch(&mergeEquivalent), "search once for the variables inducing the same partition of rows (e.g. duplicate or constant columns) and expand them back in the output");
 
       po::variables_map vm;
       po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
@@ -27,7 +51,17 @@ int main(int argc, char *argv[]) {
       }      
       po::notify(vm);
     }
-    hfpgrowth(threshold, inputFileName, outputFileName, statsFileName);
+    hfpgrowth.setCheckpoint(checkpointFileName, checkpointInterval);
+    hfpgrowth.setBudget(timeLimit, maxPatterns, frontiersFileName);
+    constraints.included_ = HFPGrowth::parseVariables(included);
+    constraints.excluded_ = HFPGrowth::parseVariables(excluded);
+    hfpgrowth.setConstraints(constraints);
+    hfpgrowth.setDenseThreshold(denseThreshold);
+    hfpgrowth.setConditionalRatio(conditionalRatio);
+    hfpgrowth.setEngine(HFPGrowth::parseEngine(engine));
+    hfpgrowth.setMergeEquivalent(mergeEquivalent);
+    hfpgrowth.setParallelism(nThreads, chunkSize);
+    hfpgrowth(threshold, HFPGrowth::parseMeasures(measures), inputFileName, outputFileName, statsFileName, resumeFileName);
     return EXIT_SUCCESS;
   } catch(const std::exception& ex) {
     std::cerr << "Error: " << ex.what() << std::endl;
@@ -2,15 +2,18 @@
 
 #include "FPTree.hpp"
 #include <map>
+#include <numeric>
 #include <gimlet/json_parser.hpp>
 #include <gimlet/data_iterator.hpp>
 
 
 namespace gimlet {	
   namespace itemsets {
+
+    FPTree::Constraints::Constraints() : included_(), excluded_(), minSize_(0), maxSize_(std::numeric_limits<size_t>::max()) {}
 	
-    FPTree::Node::Node(Node* parent, token_type count) : parent_(parent), count_(count),
-							 heir_(), partCount_() {}
+    FPTree::Node::Node(Node* parent, token_type count) : parent_(parent),
+							 heir_(), count_(count), partCount_() {}
 
     void FPTree::Node::setCount(token_type count) {
       count_ += count;
@@ -25,8 +28,8 @@ namespace gimlet {
       return next_ == nullptr;
     }
   	
-    FPTree::Level::Level() : Link(), parts_(), count_(0) {}
-    FPTree::Level::Level(pair_type attr) : Link(), parts_(), attr_(attr), count_(0) {}
+    FPTree::Level::Level() : Link(), parts_(), partCounts_(), count_(0), index_(0) {}
+    FPTree::Level::Level(pair_type attr) : Link(), parts_(), partCounts_(), attr_(attr), count_(0), index_(0) {}
 	
     FPTree::Level::iterator FPTree::Level::begin() { return iterator(next_); }
     FPTree::Level::iterator FPTree::Level::end() { return iterator(nullptr); }
@@ -68,7 +71,7 @@ namespace gimlet {
       return os;
     }
 
-    FPTree::Group::Group(attribute_type var) : std::vector<Level*>(), var_(var), H_(0.) {}
+    FPTree::Group::Group(attribute_type var) : std::vector<Level*>(), var_(var), H_(0.), required_(false), nNodes_(0) {}
     
     void FPTree::Group::computeEntropyFromLevels() {
       H_ = 0.;
@@ -84,85 +87,227 @@ namespace gimlet {
       }
     }
 
-    static double tlog2(size_t n) {
-      thread_local std::vector<double> values;
-      size_t s = values.size();
-      if(n > s) {
-	for(size_t i = s; i != n; )
-	  values.push_back(std::log2(++i));
+    void FPTree::computeLogTables(count_type n) {
+      log2s_.assign(n + 1, 0.);
+      log2Factorials_.assign(n + 1, 0.);
+      for(count_type i = 1; i <= n; ++i) {
+	log2s_[i] = std::log2(i);
+	log2Factorials_[i] = log2Factorials_[i - 1] + log2s_[i];
       }
-      return values[n-1];
     }
     
-    double FPTree::hyperGeometricProbLog(count_type k, count_type a, count_type b, count_type n) {
+    double FPTree::hyperGeometricProbLog(count_type k, count_type a, count_type b, count_type n) const {
       if(a > n || b > n || (k+n < a+b) || k > a || k > b)
 	return 0.;
-      if(a < b) std::swap(a,b);
-
-      double res = 0.;
-      count_type p1 = a;
-      count_type p2 = b;
-      count_type p3 = n;
-      count_type p4 = k;
-      count_type p5 = n-a;
-
-      for(count_type i = 0; i != k; ++i, --p1, --p2, --p3, --p4) 
-	//res += std::log2(double(p1) / p3 * p2 / p4);
-	res += tlog2(p1) - tlog2(p3) + tlog2(p2) - tlog2(p4);
-      
-      for(count_type i = 0; i != b-k; ++i, --p3, --p5)
-	//res += std::log2(double(p5) / p3);
-	res += tlog2(p5) - tlog2(p3);
-      
-      if(res > 1.) {
-	std::cerr << "res = " << res << std::endl;
-	throw std::runtime_error("Bad res");
+      const std::vector<double>& lf = log2Factorials_;
+      // log2 of C(a, k) C(n - a, b - k) / C(n, b)
+      return lf[a] - lf[k] - lf[a - k] + lf[n - a] - lf[b - k] - lf[n - a - b + k] - lf[n] + lf[b] + lf[n - b];
+    }
+    
+    double FPTree::addInfoBias(double& total, count_type ai, count_type bj, count_type n) const {
+      count_type m = ai+bj <= n+1 ? 1 : ai+bj-n;
+      count_type M = std::min(ai, bj);
+      const double* lf = log2Factorials_.data();
+      const double* l = log2s_.data();
+
+      const double base = lf[ai] + lf[bj] + lf[n - ai] + lf[n - bj] - lf[n];
+      const count_type offset = n - ai - bj; // wraps around but offset + k does not
+      auto logh = [&](count_type k) { return base - lf[k] - lf[ai - k] - lf[bj - k] - lf[offset + k]; };
+      double subtotal = 0., error = 0.;
+      if(biasTolerance_ <= 0. || M - m < 16) {
+	// Every probability is computed from the table rather than from the previous one,
+	// so that the iterations are independent and the loop can be vectorized
+	for(count_type k = m; k <= M; ++k)
+	  subtotal += std::exp2(logh(k)) * k * l[k];
+      } else {
+	// Sum from the mode outwards. The distribution being log-concave, the ratio of two consecutive
+	// probabilities only decreases away from the mode, so that the tail beyond k is bounded by a geometric
+	// series of the current ratio, times the largest weight k log k of the tail. Each side stops once
+	// its bound is below half the tolerance.
+	const double budget = biasTolerance_ * n / 2.;
+	count_type mode = std::min(M, std::max(m, (ai + 1) * (bj + 1) / (n + 2)));
+	double h = std::exp2(logh(mode));
+	subtotal += h * mode * l[mode];
+	for(count_type k = mode; k != M; ++k) {
+	  double next = std::exp2(logh(k + 1)), r = next / h;
+	  if(r < 1. && next / (1. - r) * M * l[M] <= budget) {
+	    error += next / (1. - r) * M * l[M];
+	    break;
+	  }
+	  subtotal += next * (k + 1) * l[k + 1];
+	  h = next;
+	}
+	h = std::exp2(logh(mode));
+	for(count_type k = mode; k != m; --k) {
+	  double next = std::exp2(logh(k - 1)), r = next / h;
+	  if(r < 1. && next / (1. - r) * (k - 1) * l[k - 1] <= budget) {
+	    error += next / (1. - r) * (k - 1) * l[k - 1];
+	    break;
+	  }
+	  subtotal += next * (k - 1) * l[k - 1];
+	  h = next;
+	}
       }
-      return res;
+      total += subtotal / n;
+		
+      if(ai != 0 && bj != 0) {
+	double p = double(ai) / n * bj / n;
+	total -= p * (l[ai] + l[bj] - l[n]);
+      }
+      return error / n;
     }
     
+    FPTree::BiasCache::BiasCache() : entries_(), mask_(0), hits_(0), misses_(0) {}
+
+    void FPTree::BiasCache::reset(size_t capacity) {
+      size_t size = 1;
+      while(size < capacity) size <<= 1;
+      entries_.reset(capacity == 0 ? nullptr : new Entry[size]);
+      mask_ = capacity == 0 ? 0 : size - 1;
+      for(size_t i = 0; entries_ && i != size; ++i) {
+	entries_[i].key_ = 0;
+	entries_[i].value_ = 0.;
+	entries_[i].error_ = 0.;
+      }
+      hits_ = 0;
+      misses_ = 0;
+    }
+
+    size_t FPTree::BiasCache::slot(std::uint64_t key) const {
+      return (key * 0x9E3779B97F4A7C15ull >> 20) & mask_;
+    }
+
+    bool FPTree::BiasCache::find(std::uint64_t key, double& value, double& error) const {
+      if(! entries_) return false;
+      for(size_t i = slot(key), probe = 0; probe != maxProbes; i = (i + 1) & mask_, ++probe) {
+	std::uint64_t k = entries_[i].key_.load(std::memory_order_acquire);
+	if(k == key) {
+	  value = entries_[i].value_.load(std::memory_order_relaxed);
+	  error = entries_[i].error_.load(std::memory_order_relaxed);
+	  return true;
+	}
+	if(k == 0) return false;
+      }
+      return false;
+    }
+
+    void FPTree::BiasCache::insert(std::uint64_t key, double value, double error) {
+      if(! entries_) return;
+      for(size_t i = slot(key), probe = 0; probe != maxProbes; i = (i + 1) & mask_, ++probe) {
+	std::uint64_t k = 0;
+	// The slot is claimed with the busy bit so that no reader sees the key before its value
+	if(entries_[i].key_.compare_exchange_strong(k, key | busy, std::memory_order_relaxed)) {
+	  entries_[i].value_.store(value, std::memory_order_relaxed);
+	  entries_[i].error_.store(error, std::memory_order_relaxed);
+	  entries_[i].key_.store(key, std::memory_order_release);
+	  return;
+	}
+	if((k & ~busy) == key) return;
+      }
+    }
+
+    void FPTree::BiasCache::count(size_t hits, size_t misses) {
+      hits_.fetch_add(hits, std::memory_order_relaxed);
+      misses_.fetch_add(misses, std::memory_order_relaxed);
+    }
+
+    size_t FPTree::BiasCache::hits() const { return hits_; }
+    size_t FPTree::BiasCache::misses() const { return misses_; }
+
     double FPTree::computeInfoBias(const Group& currentGroup) const {
-      std::mutex mutex;
-      count_type n = size();
-      double res = 0.;
+      thread_local std::vector<count_type> partSizes;
+      partSizes.clear();
+      for(const Level* level : currentGroup)
+	partSizes.insert(partSizes.end(), level->partCounts_.begin(), level->partCounts_.end());
+      return computeInfoBias(partSizes);
+    }
+
+    double FPTree::computeInfoBias(const std::vector<count_type>& partSizes) const {
+      // The pairs of a target level and a part are summed by chunks of consecutive pairs, each into its own
+      // slot, and the slots are added in order so that the result does not depend on the number of threads.
+      // A single chunk is summed by the calling thread. The buffers are reused by the calling thread only:
+      // the workers of the team write through pointers, since a lambda does not capture thread_local variables.
+      static constexpr size_t chunkSize = 256;
+      const Group& target = *targetGroup_;
+      const count_type n = size();
+      const size_t nParts = partSizes.size(), nPairs = target.size() * nParts;
+      thread_local std::vector<double> sums, errors;
+      sums.assign((nPairs + chunkSize - 1) / chunkSize, 0.);
+      errors.assign(sums.size(), 0.);
+      double* chunkSums = sums.data();
+      double* chunkErrors = errors.data();
       
+      team_(sums.size(), [&](size_t chunk) {
+	  double total = 0., error = 0.;
+	  size_t end = std::min(nPairs, (chunk + 1) * chunkSize), hits = 0;
+	  for(size_t pair = chunk * chunkSize; pair != end; ++pair) {
+	    count_type ai = target[pair / nParts]->count_, bj = partSizes[pair % nParts];
+	    std::uint64_t key = std::uint64_t(ai) << 32 | bj;
+	    double term, termError;
+	    if(biasCache_.find(key, term, termError))
+	      ++hits;
+	    else {
+	      term = 0.;
+	      termError = addInfoBias(term, ai, bj, n);
+	      biasCache_.insert(key, term, termError);
+	    }
+	    total += term;
+	    error += termError;
+	  }
+	  biasCache_.count(hits, end - chunk * chunkSize - hits);
+	  chunkSums[chunk] = total;
+	  chunkErrors[chunk] = error;
+	});
+      maxBiasError_ = std::max(maxBiasError_, std::accumulate(errors.begin(), errors.end(), 0.));
+      return std::accumulate(sums.begin(), sums.end(), 0.);
+    }
+       
+    double FPTree::infoBiasLowerBound(const Group& currentGroup) const {
+      thread_local std::vector<count_type> partSizes;
+      partSizes.clear();
+      for(const Level* level : currentGroup)
+	partSizes.insert(partSizes.end(), level->partCounts_.begin(), level->partCounts_.end());
+      return infoBiasLowerBound(partSizes);
+    }
+
+    double FPTree::infoBiasLowerBound(const std::vector<count_type>& partSizes) const {
+      // Every term of the bias is the gap of Jensen's inequality for k log2 k. When the smaller size m is 1
+      // or 2, k only takes the values 0, 1 and 2 and the term is computed exactly. Otherwise, the second
+      // derivative of k log2 k is at least 1 / (m ln 2) on [0, m], hence the gap is at least
+      // Var(k) / (2 m ln 2), where Var(k) is the variance of the hypergeometric distribution.
+      // The parts of sizes 1 and 2, the most frequent ones deep in the search, are only counted.
+      const count_type n = size();
+      if(n < 2) return 0.;
+      thread_local std::vector<count_type> largeParts;
+      largeParts.clear();
+      size_t nSmallParts[3] = {0, 0, 0};
+      for(count_type part : partSizes) {
+	if(part <= 2)
+	  ++nSmallParts[part];
+	else
+	  largeParts.push_back(part);
+      }
+      const double* l = log2s_.data();
+      const double nn = n;
+      // Exact term for sizes a and b whose minimum is m <= 2, o being the maximum
+      auto smallTerm = [&](count_type a, count_type b, count_type m, count_type o) {
+	const double expectation = m == 2 ? 2. * o * (o - 1.) / (nn * (nn - 1.)) : 0.;
+	return expectation - double(a) * b / nn * (l[a] + l[b] - l[n]);
+      };
+      double res = 0., quadratic = 0.;
       for(const Level* targetLevel : *targetGroup_) {
-	count_type ai = targetLevel->count_;
-	
-	for(const Level* level : currentGroup) {
-	  threads_.emplace_back([n, ai, &res, level, &mutex] () -> void {
-	      const std::vector<Node*>& parts = level->parts_;
-	      double total = 0.;
-	      
-	      for(const Node* master : parts) {
-		count_type bj = master->partCount_;
-		count_type m = ai+bj <= n+1 ? 1 : ai+bj-n;
-		count_type M = std::min(ai, bj);
-		double logh = hyperGeometricProbLog(m, ai, bj, n);
-
-		double subtotal = 0.;
-		for(count_type k = m; k <= M; ++k) {
-		  double h = std::exp2(logh);
-		  double term = h * k * tlog2(k);
-		  subtotal += term;  
-		  logh += tlog2(ai-k) - tlog2(k+1) + tlog2(bj -k) - tlog2(n - ai - bj + k + 1);
-		}
-		total += subtotal / n;
-		
-		if(ai != 0 && bj != 0) {
-		  double p = double(ai) / n * bj / n;
-		  total -= p * (tlog2(ai) + tlog2(bj) - tlog2(n));
-		}
-	      }
-	      {
-		 std::lock_guard<std::mutex> lock(mutex);
-		 res += total;
-	      }
-	    });	    
+	const count_type ai = targetLevel->count_;
+	for(count_type bj = 1; bj <= 2; ++bj)
+	  if(nSmallParts[bj])
+	    res += nSmallParts[bj] * smallTerm(ai, bj, std::min(ai, bj), std::max(ai, bj));
+	for(count_type bj : largeParts) {
+	  if(ai <= 2)
+	    res += smallTerm(ai, bj, ai, bj);
+	  else
+	    quadratic += double(ai) * bj / nn * (nn - ai) / nn * (nn - bj) / (nn - 1.) / std::min(ai, bj);
 	}
       }
-      threads_.join();
-      return res;
+      return (res + quadratic / (2. * std::log(2.))) / nn;
     }
        
     double FPTree::Group::intersect() {
@@ -172,6 +317,7 @@ namespace gimlet {
       for(Level* level : *this) {
 	std::vector<Node*>& parts = level->parts_;
 	parts.clear();
+	level->partCounts_.clear();
 	auto it = level->begin(), end = level->end();	  
 	for(; it != end; ++it) {
 	  Node* node = *it;
@@ -191,6 +337,8 @@ namespace gimlet {
 	  count_type c = master->partCount_;
 	  H -= c * std::log2(c);
 	  total += c;
+	  // The master is shared with the other levels, hence its count is saved before being reset
+	  level->partCounts_.push_back(c);
 	  master->heir_ = nullptr;
 	}
       }
@@ -209,24 +357,170 @@ namespace gimlet {
       return os;
     }
 
-    void FPTree::skip(Group& group) {
-      for(Level* level : group) {
-	threads_.emplace_back([level]() {
-	    auto it = level->begin(), end = level->end();	  
-	    for(; it != end; ++it)
-	      it->master_ = it->parent_->master_;
-	  });
+    FPTree::Bitmaps::Bitmaps(const std::vector<pattern_type>& data, const FPTree& tree) :
+      nWords_((data.size() + 63) / 64), depth_(0),
+      levels_(tree.sortedGroups_.size()), cards_(tree.sortedGroups_.size()),
+      parts_(1), sizes_(1), singletons_(1, 0), complete_(true), counts_() {
+      for(const Group* group : tree.sortedGroups_) {
+	levels_[group->index_].assign((group->size() + 1) * nWords_, 0);
+	cards_[group->index_] = group->size();
+      }
+      
+      for(size_t row = 0; row != data.size(); ++row) {
+	word_type bit = word_type(1) << (row % 64);
+	for(const pair_type& attr : data[row]) {
+	  const Group& group = tree.groups_.at(attr.first);
+	  levels_[group.index_][tree.levels_.at(attr).index_ * nWords_ + row / 64] |= bit;
+	}
+      }
+
+      // The rows without a value for a variable make an extra part which does not count in the entropy
+      for(const Group* group : tree.sortedGroups_) {
+	std::vector<word_type>& levels = levels_[group->index_];
+	count_type total = 0;
+	for(const Level* level : *group) total += level->count_;
+	if(total == data.size())
+	  levels.resize(group->size() * nWords_);
+	else {
+	  complete_ = false;
+	  word_type* missing = &levels[group->size() * nWords_];
+	  for(size_t row = 0; row != data.size(); ++row)
+	    missing[row / 64] |= word_type(1) << (row % 64);
+	  for(size_t l = 0; l != group->size(); ++l)
+	    for(size_t w = 0; w != nWords_; ++w)
+	      missing[w] &= ~levels[l * nWords_ + w];
+	}
       }
-      threads_.join();
+
+      std::vector<word_type>& all = parts_[0];
+      all.assign(nWords_, ~word_type(0));
+      if(data.size() % 64 != 0) all.back() = (word_type(1) << (data.size() % 64)) - 1;
+      sizes_[0].assign(data.empty() ? 0 : 1, data.size());
+    }
+
+    double FPTree::Bitmaps::refine(size_t varIndex) {
+      const std::vector<word_type>& levels = levels_[varIndex];
+      const size_t nLevels = levels.size() / nWords_, card = cards_[varIndex];
+      if(parts_.size() == depth_ + 1) {
+	parts_.emplace_back();
+	sizes_.emplace_back();
+	singletons_.push_back(0);
+      }
+      const std::vector<count_type>& sizes = sizes_[depth_];
+      std::vector<count_type>& refinedSizes = sizes_[depth_ + 1];
+      std::vector<word_type>& refined = parts_[depth_ + 1];
+      refined.resize(sizes.size() * nLevels * nWords_);
+      refinedSizes.clear();
+
+      const word_type* part = parts_[depth_].data();
+      word_type* out = refined.data();
+      double H = 0.;
+      count_type singletons = singletons_[depth_], total = singletons;
+      counts_.assign(singletons, 1);
+      for(count_type size : sizes) {
+	// Once the whole part is covered, the remaining levels cannot intersect it
+	count_type covered = 0;
+	for(size_t l = 0; l != nLevels && covered != size; ++l) {
+	  const word_type* level = &levels[l * nWords_];
+	  count_type c = 0;
+	  for(size_t w = 0; w != nWords_; ++w) {
+	    word_type bits = part[w] & level[w];
+	    out[w] = bits;
+	    c += __builtin_popcountll(bits);
+	  }
+	  if(c == 1 && complete_) {
+	    ++singletons;
+	    ++total;
+	    ++covered;
+	    counts_.push_back(1);
+	  } else if(c != 0) {
+	    out += nWords_;
+	    refinedSizes.push_back(c);
+	    covered += c;
+	    if(l < card) {
+	      H -= c * std::log2(c);
+	      total += c;
+	      counts_.push_back(c);
+	    }
+	  }
+	}
+	part += nWords_;
+      }
+      singletons_[depth_ + 1] = singletons;
+
+      if(total != 0) {
+	H /= total;
+	H += std::log2(total);
+      }
+      return H;
+    }
+
+    const std::vector<FPTree::count_type>& FPTree::Bitmaps::counts() const { return counts_; }
+    void FPTree::Bitmaps::push() { ++depth_; }
+    void FPTree::Bitmaps::pop() { --depth_; }
+
+    FPTree::DependencyTrie::DependencyTrie() : nodes_(1, Node{{}, false}) {}
+
+    void FPTree::DependencyTrie::insert(const std::vector<attribute_type>& indexes) {
+      size_t node = 0;
+      for(attribute_type index : indexes) {
+	auto it = nodes_[node].children_.find(index);
+	if(it == nodes_[node].children_.end()) {
+	  it = nodes_[node].children_.emplace(index, nodes_.size()).first;
+	  nodes_.push_back(Node{{}, false});
+	}
+	node = it->second;
+      }
+      nodes_[node].terminal_ = true;
+    }
+
+    bool FPTree::DependencyTrie::includedIn(const std::vector<attribute_type>& indexes, attribute_type last) const {
+      // Walk down every path of the trie whose indexes are a subsequence of the sorted indexes
+      std::vector<std::pair<size_t, size_t>> stack{{0, 0}}; // node and position in indexes
+      while(! stack.empty()) {
+	auto node = stack.back();
+	stack.pop_back();
+	const auto& children = nodes_[node.first].children_;
+	auto it = children.find(last);
+	if(it != children.end() && nodes_[it->second].terminal_)
+	  return true;
+	for(size_t i = node.second; i != indexes.size(); ++i) {
+	  it = children.find(indexes[i]);
+	  if(it != children.end())
+	    stack.emplace_back(it->second, i + 1);
+	}
+      }
+      return false;
+    }
+
+    size_t FPTree::DependencyTrie::size() const {
+      return std::count_if(nodes_.begin(), nodes_.end(), [](const Node& node) { return node.terminal_; });
+    }
+
+    void FPTree::skip(Group& group) {
+      auto skip = [&group](size_t i) {
+	Level* level = group[i];
+	auto it = level->begin(), end = level->end();	  
+	for(; it != end; ++it)
+	  it->master_ = it->parent_->master_;
+      };
+      if(group.nNodes_ < parallelThreshold_)
+	for(size_t i = 0; i != group.size(); ++i) skip(i);
+      else
+	team_(group.size(), skip);
     }
     
-    FPTree::FPTree(int target, size_t nThreads) :
-      threads_(nThreads), levels_(), groups_(),
+    FPTree::FPTree(int target, size_t nThreads, const Constraints& constraints, Engine engine) :
+      team_(nThreads), biasCache_(), log2s_(), log2Factorials_(),
+      biasTolerance_(0.), maxBiasError_(0.), nBoundPrunings_(0), nBiasPrunings_(0),
+      bound_(Bound::bias), nExpanded_(0), nRefinedPrunings_(0), seeded_(0),
+      minimal_(false), minimalTolerance_(0.), dependencies_(), nMinimalPrunings_(0), parallelThreshold_(0), levels_(), groups_(),
       pool_(new boost::object_pool<Node>()),
       size_(0), nbrNodes_(0),
       root_(nullptr, 0),
       targetEntropy_(0.), targetGroup_(),
-      target_(target) {
+      target_(target), constraints_(constraints),
+      engine_(engine), bitmaps_() {
       root_.master_ = &root_;
       root_.level_ = nullptr;
     }
@@ -336,6 +630,7 @@ namespace gimlet {
       Level& level = (res.first)->second;
       if(res.second) {
 	Group& g = group(attr.first);
+	level.index_ = g.size();
 	g.push_back(&level);
       }
       return level;
@@ -350,6 +645,7 @@ namespace gimlet {
       Level& lvl = this->level(attr);
       Node* node = pool_->construct(parent, 0);
       ++nbrNodes_;
+      ++group(attr.first).nNodes_;
       node->master_ = parent->master_;
       node->level_ = &lvl;      
       lvl.push_back(node);
@@ -357,6 +653,7 @@ namespace gimlet {
     }
 
     void FPTree::build(std::vector<pattern_type>& data) {
+      computeLogTables(data.size());
       auto difference = [] (const pattern_type& p1, const pattern_type &p2) -> int {
 	auto b1 = p1.begin(), e1 = p1.end();
 	auto b2 = p2.begin(), e2 = p2.end();
@@ -375,16 +672,25 @@ namespace gimlet {
       std::vector<const pattern_type*> dataRefs;
 
       {
-	// Store the data pointers and record attributes to compute entropy of variables
+	// Store the data pointers and record attributes to compute entropy of variables,
+	// dropping the excluded variables
+	const std::set<attribute_type>& excluded = constraints_.excluded_;
 	attribute_type maxAttr = 0;
-	for(const pattern_type& pattern : data) {
+	for(pattern_type& pattern : data) {
+	  for(const pair_type& attr : pattern)
+	    if(maxAttr < attr.first) maxAttr = attr.first;
+	  if(! excluded.empty())
+	    pattern.erase(std::remove_if(pattern.begin(), pattern.end(),
+					 [&excluded](const pair_type& attr) { return excluded.count(attr.first) != 0; }),
+			  pattern.end());
 	  dataRefs.push_back(&pattern);
-	  attribute_type maxPatternAttr = record(pattern.begin(), pattern.end());
-	  if(maxPatternAttr > maxAttr) maxAttr = maxPatternAttr;
+	  record(pattern.begin(), pattern.end());
 	}
 	if(target_ < 0) target_ = maxAttr + 1 + target_;
 	if(target_ < 0 || target_ > maxAttr)
 	  throw std::runtime_error(std::string("out of range target ") + std::to_string(target_));
+	if(excluded.count(target_) != 0 || constraints_.included_.count(target_) != 0)
+	  throw std::runtime_error("the target variable can be neither excluded nor required");
 	  
 	// Compute the entropy of every variable
 	auto begin =  sortedGroups_.begin(), end = sortedGroups_.end();
@@ -402,6 +708,13 @@ namespace gimlet {
 
 	if(! targetGroup_)
 	  throw std::runtime_error("Unknown target variable");
+
+	for(attribute_type var : constraints_.included_) {
+	  auto it = groups_.find(var);
+	  if(it == groups_.end())
+	    throw std::runtime_error(std::string("unknown or excluded required variable ") + std::to_string(var));
+	  it->second.required_ = true;
+	}
 	
 	std::swap(*targetIt, *(--end));
 
@@ -433,6 +746,12 @@ namespace gimlet {
 	for(pattern_type& pattern : data)
 	  for(auto& attr : pattern) attr.first = sortedGroups_[attr.first]->var_;
       }
+
+      if(engine_ == Engine::bitmap) {
+	bitmaps_.reset(new Bitmaps(data, *this));
+	size_ = data.size();
+	return;
+      }
       
       pattern_type root;
       const pattern_type* pred = &root;
@@ -470,13 +789,49 @@ namespace gimlet {
 
     double FPTree::targetEntropy() const { return targetEntropy_; }
 
-    void FPTree::build(std::istream& is) {
+    void FPTree::setParallelThreshold(size_t threshold) { parallelThreshold_ = threshold; }
+
+    void FPTree::setBiasCache(size_t capacity) { biasCache_.reset(capacity); }
+    void FPTree::setBiasTolerance(double tolerance) { biasTolerance_ = tolerance; }
+    double FPTree::maxBiasError() const { return maxBiasError_; }
+    void FPTree::setBound(Bound bound) { bound_ = bound; }
+    void FPTree::setSeeded(size_t size) { seeded_ = size; }
+    void FPTree::setMinimal(double tolerance) { minimal_ = true; minimalTolerance_ = tolerance; }
+    size_t FPTree::nDependencies() const { return dependencies_.size(); }
+    size_t FPTree::nMinimalPrunings() const { return nMinimalPrunings_; }
+    size_t FPTree::nExpanded() const { return nExpanded_; }
+    size_t FPTree::nRefinedPrunings() const { return nRefinedPrunings_; }
+    size_t FPTree::nBoundPrunings() const { return nBoundPrunings_; }
+    size_t FPTree::nBiasPrunings() const { return nBiasPrunings_; }
+    size_t FPTree::biasCacheHits() const { return biasCache_.hits(); }
+    size_t FPTree::biasCacheMisses() const { return biasCache_.misses(); }
+
+    std::vector<FPTree::pattern_type> FPTree::read(std::istream& is) {
       auto JSON_parser = gimlet::make_JSON_parser<flow<pattern_type>>();
       auto input_stream = gimlet::make_input_data_stream(is, JSON_parser);
       auto begin = gimlet::make_input_data_begin<decltype(input_stream), pattern_type>(input_stream);
       auto end = gimlet::make_input_data_end<decltype(input_stream), pattern_type>(input_stream);
       
-      build(begin, end);
+      return std::vector<pattern_type>(begin, end);
     }
+
+    void FPTree::build(std::istream& is) {
+      std::vector<pattern_type> data = read(is);
+      build(data);
+    }
+
+    FPTree::position_type FPTree::roots() const {
+      position_type roots;
+      bool full = constraints_.maxSize_ == 0;
+      for(size_t varIndex = 0; varIndex != nVars(); ++varIndex)
+	if(! full || varIndex + 1 == nVars()) {
+	  roots.push_back(Frame{static_cast<attribute_type>(varIndex), false});
+	  if(sortedGroups_[varIndex]->required_) break;
+	}
+      return roots;
+    }
+
+    int FPTree::target() const { return target_; }
+    attribute_type FPTree::variable(size_t varIndex) const { return sortedGroups_[varIndex]->var_; }
   }
 }
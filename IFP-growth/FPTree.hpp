@@ -3,8 +3,12 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>
+#include <limits>
 #include <memory>
+#include <atomic>
 #include <utility>
+#include <cstdint>
 #include <type_traits>
 #include <boost/pool/object_pool.hpp>
 #include "gimlet/thread_pool.hpp"
@@ -27,13 +31,33 @@ namespace gimlet {
     
     class FPTree {
 
-      using token_type = unsigned short;
+      using token_type = unsigned int;
 
     public:
 
       using count_type = unsigned long;
       using pair_type = std::pair<attribute_type, attribute_value_type>;     
       using pattern_type = std::vector<pair_type>;
+
+      // Constraints on the variables of the enumerated patterns
+      struct Constraints {
+	std::set<attribute_type> included_, excluded_;
+	size_t minSize_, maxSize_;
+
+	Constraints();
+      };
+
+      // Data structure on which partitions are refined
+      enum class Engine {
+	tree,  // levels of the FP-tree
+	bitmap // bitmaps of rows, for small datasets the tree hardly compresses
+      };
+
+      // Upper bound of the scores of the supersets of a pattern by which the search is pruned
+      enum class Bound {
+	bias,   // 1 - bias of the pattern, before it is extended
+	refined // also 1 - bias of the pattern refined by the target, once it is scored
+      };
       
       struct Link {
 	Link *next_;
@@ -44,14 +68,15 @@ namespace gimlet {
       
       struct Level;
       
+      // The counts come last so that they share the same word
       struct Node : Link {
 	Node* parent_;
-	token_type count_;
 	Node* master_;
 	Level* level_;
 
 	Node* heir_;
-	count_type partCount_;
+	token_type count_;
+	token_type partCount_;
 	
 	Node(Node* parent, token_type count);
 	Node(const Node&) = default;
@@ -63,8 +88,10 @@ namespace gimlet {
 
       struct Level : Link {
 	std::vector<Node*> parts_;
+	std::vector<count_type> partCounts_; // sizes of the parts of the level computed by the last intersection
 	pair_type attr_;
 	count_type count_;
+	unsigned int index_; // index of the level in its group
 	
 	Level();
 	Level(pair_type attr);
@@ -116,6 +143,8 @@ namespace gimlet {
 	attribute_type var_;
 	double H_;
 	attribute_type index_;
+	bool required_;
+	size_t nNodes_;
 	
 	Group(attribute_type var);
 
@@ -123,11 +152,103 @@ namespace gimlet {
 	double intersect();
       };
 
+      // One bitmap of rows per level. Partitions are refined by AND-ing the bitmaps of their parts
+      // with those of levels and counting the bits of the results.
+      class Bitmaps {
+	using word_type = std::uint64_t;
+	
+	size_t nWords_, depth_;
+	std::vector<std::vector<word_type>> levels_; // per variable, the bitmaps of its levels then of its missing values if any
+	std::vector<unsigned int> cards_;
+	std::vector<std::vector<word_type>> parts_;  // per depth, the bitmaps of the parts of the partition
+	std::vector<std::vector<count_type>> sizes_; // per depth, the sizes of the parts
+	// Per depth, the number of rows alone in their part. When every row has a value for every variable,
+	// these parts cannot be split any more and are counted without being stored.
+	std::vector<count_type> singletons_;
+	bool complete_;
+	std::vector<count_type> counts_; // sizes of the parts counted by the last refinement
+
+      public:
+	Bitmaps(const std::vector<pattern_type>& data, const FPTree& tree);
+
+	// Entropy of the current pattern extended with the variable of index varIndex
+	double refine(size_t varIndex);
+	// Sizes of the parts of the partition computed by the last refinement, rows without values excepted
+	const std::vector<count_type>& counts() const;
+	// Make the partition computed by the last refinement the current one
+	void push();
+	void pop();
+      };
+
+      // Bias terms indexed by the sizes of a target value and of a part, shared by the threads without locks.
+      // The table is never resized: the pairs whose slots are all taken are not cached.
+      class BiasCache {
+	struct Entry {
+	  std::atomic<std::uint64_t> key_; // 0 if empty, with the busy bit set while the value is being written
+	  std::atomic<double> value_, error_;
+	};
+	static constexpr std::uint64_t busy = std::uint64_t(1) << 63;
+	static constexpr size_t maxProbes = 16;
+	
+	std::unique_ptr<Entry[]> entries_;
+	size_t mask_;
+	std::atomic<size_t> hits_, misses_;
+
+	size_t slot(std::uint64_t key) const;
+
+      public:
+	BiasCache();
+	// Allocate room for capacity terms rounded up to a power of 2 (0 to disable the cache)
+	void reset(size_t capacity);
+	bool find(std::uint64_t key, double& value, double& error) const;
+	void insert(std::uint64_t key, double value, double error);
+	void count(size_t hits, size_t misses);
+	size_t hits() const;
+	size_t misses() const;
+      };
+      
+      // Patterns on which the target depends, as the sorted indexes of their variables in a prefix tree
+      class DependencyTrie {
+	struct Node {
+	  std::map<attribute_type, size_t> children_;
+	  bool terminal_;
+	};
+	std::vector<Node> nodes_;
+
+      public:
+	DependencyTrie();
+	void insert(const std::vector<attribute_type>& indexes);
+	// Whether a recorded pattern whose last index is last is included in the sorted indexes followed by last
+	bool includedIn(const std::vector<attribute_type>& indexes, attribute_type last) const;
+	size_t size() const;
+      };
+      
       void skip(Group&);
-      static double hyperGeometricProbLog(count_type k, count_type a, count_type b, count_type n);
+      // Fill the tables of log2(i) and log2(i!) for i up to n, read by every thread
+      void computeLogTables(count_type n);
+      double hyperGeometricProbLog(count_type k, count_type a, count_type b, count_type n) const;
+      // Add the bias term of a target value of size ai and of a part of size bj, and return a bound on its error
+      double addInfoBias(double& total, count_type ai, count_type bj, count_type n) const;
       double computeInfoBias(const Group& currentGroup) const;
+      double computeInfoBias(const std::vector<count_type>& partSizes) const;
+      // Lower bound of the bias computed from the sizes of the parts in constant time per pair of sizes
+      double infoBiasLowerBound(const Group& currentGroup) const;
+      double infoBiasLowerBound(const std::vector<count_type>& partSizes) const;
       
-      mutable cool::ThreadPool threads_;
+      mutable cool::ParallelTeam team_;
+      mutable BiasCache biasCache_;
+      std::vector<double> log2s_, log2Factorials_;
+      double biasTolerance_;         // error allowed on every bias term, 0 for exact terms
+      mutable double maxBiasError_;  // largest bound on the error of a bias computed so far
+      size_t nBoundPrunings_, nBiasPrunings_; // branches pruned by the lower bound of the bias and by the bias itself
+      Bound bound_;
+      size_t nExpanded_, nRefinedPrunings_; // patterns extended, and scored patterns whose supersets are pruned
+      size_t seeded_; // size up to which patterns were scored by a pre-pass and are not scored again
+      bool minimal_;
+      double minimalTolerance_; // fraction of information below 1 from which a pattern is a dependency
+      DependencyTrie dependencies_;
+      size_t nMinimalPrunings_; // branches pruned as supersets of dependencies
+      size_t parallelThreshold_; // number of nodes of a group below which it is skipped by the calling thread
       std::map<pair_type, Level> levels_;
       std::map<attribute_type, Group> groups_;
       std::vector<Group*> sortedGroups_;
@@ -138,6 +259,9 @@ namespace gimlet {
       double targetEntropy_;
       Group* targetGroup_;
       int target_;
+      Constraints constraints_;
+      Engine engine_;
+      std::unique_ptr<Bitmaps> bitmaps_;
       
       Group& group(attribute_type attr);
       Level& level(const pair_type& attr);
@@ -149,21 +273,27 @@ namespace gimlet {
       class Iterator;
             
       template<typename Iterator>
-      attribute_type record(const Iterator& begin, const Iterator& end) {
-	attribute_type maxAttr = 0;
+      void record(const Iterator& begin, const Iterator& end) {
 	for(Iterator it = begin; it != end; ++it) {
 	  const pair_type& attr = *it;
-	  if(maxAttr < attr.first) maxAttr = attr.first;
 	  Level& lvl = level(attr);
 	  ++lvl.count_;
 	}
-	return maxAttr;
       }
 
       void build(std::vector<pattern_type>& data);
 
     public:
-      FPTree(int target, size_t nThreads);
+      // A step of the enumeration: the index of a variable in the search order and
+      // whether this variable belongs to the patterns being enumerated
+      struct Frame {
+	attribute_type index_;
+	bool included_;
+      };
+      // Position of the enumeration in the search space, from which it can be resumed
+      using position_type = std::vector<Frame>;
+      
+      FPTree(int target, size_t nThreads, const Constraints& constraints = Constraints(), Engine engine = Engine::tree);
       FPTree(const FPTree&) = delete;
       FPTree(FPTree&&) = default;
 
@@ -177,10 +307,38 @@ namespace gimlet {
       }
       
       void build(std::istream&);
+      // Rows of a dataset
+      static std::vector<std::vector<pair_type>> read(std::istream&);
+      // Frames stacked by the search below the empty pattern, the last one being processed first
+      position_type roots() const;
+      // Target variable, counted from the first one once the tree is built
+      int target() const;
+      // Variable of index varIndex in the search order
+      attribute_type variable(size_t varIndex) const;
       size_t size() const;
       size_t nbrNodes() const;
       size_t nVars() const;
       double targetEntropy() const;
+      // Skip the groups of at least threshold nodes in parallel
+      void setParallelThreshold(size_t threshold);
+      // Cache up to capacity bias terms (0 to disable)
+      void setBiasCache(size_t capacity);
+      // Truncate the sums of bias terms once the error of every term is below tolerance (0 for exact sums)
+      void setBiasTolerance(double tolerance);
+      double maxBiasError() const;
+      void setBound(Bound bound);
+      // Do not score the patterns of at most size variables any more
+      void setSeeded(size_t size);
+      // Prune the supersets of the patterns whose fraction of information is at least 1 - tolerance
+      void setMinimal(double tolerance);
+      size_t nDependencies() const;
+      size_t nMinimalPrunings() const;
+      size_t nExpanded() const;
+      size_t nRefinedPrunings() const;
+      size_t nBoundPrunings() const;
+      size_t nBiasPrunings() const;
+      size_t biasCacheHits() const;
+      size_t biasCacheMisses() const;
       void internalState(std::ostream& os);
 
       using const_iterator = Iterator;
@@ -192,7 +350,10 @@ namespace gimlet {
       friend std::ostream& operator<<(std::ostream&, const FPTree&);     
 
       template<typename Processor, typename Selector>
-      void generate(Processor& processor, const Selector& selector);
+      void generate(Processor& processor, const Selector& selector, const position_type& position = position_type());
+      // Score the patterns of at most size variables, which later searches do not score again
+      template<typename Processor, typename Selector>
+      void seed(Processor& processor, const Selector& selector, size_t size);
     };
 
     template<typename Processor, typename Selector>
@@ -203,49 +364,201 @@ namespace gimlet {
       const Group* targetGroup_;
       count_type n_;
       double HY_, HX_, bias_;
+      position_type stack_;
+      const Constraints& constraints_;
+      size_t size_, nRequired_;
+      size_t maxSize_, seeded_;
+      std::vector<attribute_type> indexes_; // indexes of the variables of the current pattern
+      Bitmaps* bitmaps_;
 
-      void develop(size_t varIndex) {
-	Group& group = *tree_.sortedGroups_[varIndex];
-	//tree_.internalState(std::cerr);
-	++varIndex;
-
-	tree_.skip(group);
-	if(varIndex != tree_.nVars()) {
-	  develop(varIndex);
-	  HX_ = group.intersect();
-	  bias_ = tree_.computeInfoBias(group) / HY_;
-	  double upperBound = 1. - bias_;
-	  if(selector_(upperBound)) {
-	    processor_.push(group.var_);
-	    develop(varIndex);
-	    processor_.pop();
+      // Entropy of the current pattern extended with group, computed on the tree or on the bitmaps
+      double intersect(Group& group) {
+	return bitmaps_ ? bitmaps_->refine(group.index_) : group.intersect();
+      }
+
+      double infoBias(const Group& group) const {
+	return bitmaps_ ? tree_.computeInfoBias(bitmaps_->counts()) : tree_.computeInfoBias(group);
+      }
+
+      double infoBiasLowerBound(const Group& group) const {
+	return bitmaps_ ? tree_.infoBiasLowerBound(bitmaps_->counts()) : tree_.infoBiasLowerBound(group);
+      }
+
+      // Whether the current pattern extended with group could satisfy the size and inclusion constraints
+      bool isExtensible(const Group& group) const {
+	size_t missing = constraints_.included_.size() - nRequired_ - group.required_;
+	return size_ + 1 + missing <= maxSize_;
+      }
+
+      void include(const Group& group) {
+	if(bitmaps_) bitmaps_->push();
+	processor_.push(group.var_);
+	indexes_.push_back(group.index_);
+	++size_;
+	nRequired_ += group.required_;
+      }
+
+      void exclude(const Group& group) {
+	if(bitmaps_) bitmaps_->pop();
+	processor_.pop();
+	indexes_.pop_back();
+	--size_;
+	nRequired_ -= group.required_;
+      }
+
+      // Whether the current pattern extended with group includes a dependency, and so cannot be minimal
+      bool isRedundant(const Group& group) const {
+	if(! tree_.minimal_ || ! tree_.dependencies_.includedIn(indexes_, group.index_))
+	  return false;
+	++tree_.nMinimalPrunings_;
+	return true;
+      }
+
+      // Skip every variable from varIndex, stacking one frame per variable.
+      // Branches skipping a required variable are not explored and
+      // the variables of a full pattern are skipped without frames.
+      void descend(size_t varIndex) {
+	size_t last = tree_.nVars() - 1;
+	bool full = size_ >= maxSize_;
+	for(; varIndex != tree_.nVars(); ++varIndex) {
+	  Group& group = *tree_.sortedGroups_[varIndex];
+	  if(! bitmaps_) tree_.skip(group);
+	  if(! full || varIndex == last) {
+	    stack_.push_back(Frame{static_cast<attribute_type>(varIndex), false});
+	    if(group.required_) break;
 	  }
-	} else {
-	  double HXY = group.intersect();
+	}
+      }
+
+      // Score the current pattern from the partition refined by the target variable and
+      // return whether its supersets could still be selected
+      bool score(Group& targetGroup) {
+	bool scored = nRequired_ == constraints_.included_.size() && size_ >= constraints_.minSize_
+	  && (seeded_ == 0 || size_ > seeded_);
+	bool bounded = tree_.bound_ == Bound::refined && stack_.size() >= 2 && ! stack_[stack_.size() - 2].included_;
+	if(! scored && ! bounded)
+	  return true;
+	//tree_.internalState(std::cerr);
+	double HXY = intersect(targetGroup);
+	if(scored) {
 	  double MIXY = 1. - (HXY - HX_) / HY_;
 	  double reliableFractionOfMutualInfo = MIXY - bias_;
 	  if(selector_(reliableFractionOfMutualInfo)) {
 	    processor_.emit(reliableFractionOfMutualInfo);
 	  }
+	  if(tree_.minimal_ && MIXY >= 1. - tree_.minimalTolerance_ - 1e-12) {
+	    // Its supersets are not minimal
+	    tree_.dependencies_.insert(indexes_);
+	    return false;
+	  }
+	}
+	if(! bounded)
+	  return true;
+	// Refining a superset Z of the pattern by the target makes its fraction of information 1 and
+	// adds at most H(Y|Z) to its bias: 1 - bias of the pattern refined by the target bounds the score
+	// of Z. Its lower bound is tried first, and both are slightly lowered against rounding errors.
+	if(selector_(1. - infoBiasLowerBound(targetGroup) * (1. - 1e-9) / HY_)
+	   && selector_(1. - infoBias(targetGroup) * (1. - 1e-9) / HY_))
+	  return true;
+	++tree_.nRefinedPrunings_;
+	return false;
+      }
+
+      // Restore the partitions and the pattern of a position without scoring anything
+      void resume(const position_type& position) {
+	const Group* lastIncluded = nullptr;
+	auto frame = position.begin();
+	for(size_t varIndex = 0; frame != position.end(); ++varIndex) {
+	  if(varIndex >= tree_.nVars())
+	    throw std::runtime_error("invalid search position");
+	  Group& group = *tree_.sortedGroups_[varIndex];
+	  if(! bitmaps_) tree_.skip(group);
+	  if(frame->index_ == varIndex) {
+	    stack_.push_back(*frame);
+	    if(frame->included_) {
+	      HX_ = intersect(group);
+	      include(group);
+	      lastIncluded = &group;
+	    }
+	    ++frame;
+	  }
+	}
+	if(lastIncluded)
+	  bias_ = infoBias(*lastIncluded) / HY_;
+      }
+
+      void run() {
+	while(! stack_.empty() && processor_.checkpoint(stack_)) {
+	  Frame& frame = stack_.back();
+	  Group& group = *tree_.sortedGroups_[frame.index_];
+	  size_t varIndex = frame.index_ + 1;
+	  if(varIndex == tree_.nVars()) {
+	    if(! score(group)) {
+	      // Skip the supersets of the current pattern
+	      stack_.pop_back();
+	      while(! stack_.empty() && ! stack_.back().included_)
+		stack_.pop_back();
+	      continue;
+	    }
+	  } else if(! frame.included_) {
+	    if(isExtensible(group) && ! isRedundant(group)) {
+	      HX_ = intersect(group);
+	      // The exact bias is only computed for the branches a lower bound of it does not prune.
+	      // The bound is slightly lowered so that rounding errors cannot make it exceed the bias.
+	      if(! selector_(1. - infoBiasLowerBound(group) * (1. - 1e-9) / HY_))
+		++tree_.nBoundPrunings_;
+	      else {
+		bias_ = infoBias(group) / HY_;
+		double upperBound = 1. - bias_;
+		if(selector_(upperBound)) {
+		  include(group);
+		  ++tree_.nExpanded_;
+		  frame.included_ = true;
+		  descend(varIndex);
+		  continue;
+		}
+		++tree_.nBiasPrunings_;
+	      }
+	    }
+	  } else
+	    exclude(group);
+	  stack_.pop_back();
 	}
       }
 
     public:
-      PatternGenerator(FPTree& tree, Processor& processor, const Selector& selector) :
+      PatternGenerator(FPTree& tree, Processor& processor, const Selector& selector, size_t maxSize, size_t seeded) :
 	tree_(tree),
 	processor_(processor),
 	selector_(selector),
 	targetGroup_(tree.targetGroup_), n_(tree_.size()),
-	HY_(tree.targetEntropy()), HX_(), bias_() {}
-      void generate() {
-	develop(0);
+	HY_(tree.targetEntropy()), HX_(), bias_(), stack_(),
+	constraints_(tree.constraints_), size_(0), nRequired_(0),
+	maxSize_(maxSize), seeded_(seeded),
+	bitmaps_(tree.bitmaps_.get()) {
+	stack_.reserve(tree.nVars());
+      }
+      
+      void generate(const position_type& position) {
+	if(position.empty())
+	  descend(0);
+	else
+	  resume(position);
+	run();
       }
     };
 
     template<typename Processor, typename Selector>
-    void FPTree::generate(Processor& processor, const Selector& selector) {
-      PatternGenerator<Processor, Selector> generator{*this, processor, selector};
-      generator.generate();
-    }    
+    void FPTree::generate(Processor& processor, const Selector& selector, const position_type& position) {
+      PatternGenerator<Processor, Selector> generator{*this, processor, selector, constraints_.maxSize_, seeded_};
+      generator.generate(position);
+    }
+
+    template<typename Processor, typename Selector>
+    void FPTree::seed(Processor& processor, const Selector& selector, size_t size) {
+      PatternGenerator<Processor, Selector> generator{*this, processor, selector, std::min(size, constraints_.maxSize_), 0};
+      generator.generate(position_type());
+      seeded_ = size;
+    }
   }
 }
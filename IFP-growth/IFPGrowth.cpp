@@ -1,8 +1,18 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <limits>
 #include <map>
 #include <algorithm>
+#include <cstdio>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <memory>
+#include <exception>
+#include <mutex>
+#include <functional>
+#include <ctime>
 #include "gimlet/timer.hpp"
 #include "IFPGrowth.hpp"
 
@@ -14,55 +24,370 @@ namespace gimlet {
 
     //    using count_type = FPTree::count_type;
     using pair_type = FPTree::pair_type;
+    using checkpoint_value_type = std::tuple<std::vector<std::pair<attribute_type, bool>>, std::vector<size_t>,
+					     std::vector<std::pair<double, std::vector<attribute_type>>>, unsigned int, double>;
+    // Unix time, elapsed time, worst score of the top-k patterns, search steps, scored patterns and top-k patterns
+    using snapshot_value_type = std::tuple<double, double, double, unsigned int, unsigned int,
+					   std::vector<std::pair<double, std::vector<attribute_type>>>>;
+
+    // Write a file through a temporary one so that the previous version remains valid until replaced
+    static void replaceFile(const std::string& fileName, const std::function<void(std::ostream&)>& write) {
+      std::string tmpFileName = fileName + ".tmp";
+      {
+	std::ofstream file(tmpFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	file.precision(17);
+	write(file);
+	if(! file.good())
+	  throw std::runtime_error(std::string("cannot write file ") + tmpFileName);
+      }
+      if(std::rename(tmpFileName.c_str(), fileName.c_str()) != 0)
+	throw std::runtime_error(std::string("cannot replace file ") + fileName);
+    }
     
-    class IFPGrowth::PatternProcessor {
+    // Best patterns in a min-heap of fixed capacity, whose variables are stored in a preallocated arena.
+    // Among patterns of equal scores, the first inserted is the worst as with a multimap.
+    class IFPGrowth::TopKHeap {
+      using pattern_type = std::vector<attribute_type>;
+      
+      struct Entry {
+	double score_;
+	std::uint64_t order_;
+	size_t size_;
+	attribute_type* vars_; // span of the arena
+      };
+      // Heap order putting the worst entry first
+      static bool better(const Entry& e1, const Entry& e2) {
+	return e1.score_ > e2.score_ || (e1.score_ == e2.score_ && e1.order_ > e2.order_);
+      }
+      
+      size_t K_, width_;
+      std::vector<Entry> heap_;
+      std::vector<attribute_type> arena_;
+      std::uint64_t nInserted_;
+      double worstScore_;
+
+    public:
+      // Room for K patterns of at most width variables
+      TopKHeap(size_t K, size_t width) :
+	K_(K), width_(width), heap_(), arena_(K * width), nInserted_(0),
+	worstScore_(-std::numeric_limits<double>::max()) {
+	heap_.reserve(K);
+      }
+      // The entries point into the arena, whose buffer a move keeps but a copy does not
+      TopKHeap(const TopKHeap&) = delete;
+      TopKHeap(TopKHeap&&) = default;
+
+      // Score a pattern must exceed to enter, once the heap is full
+      double worstScore() const { return worstScore_; }
+      bool full() const { return heap_.size() == K_; }
+
+      template<typename Iterator>
+      bool insert(double score, Iterator begin, Iterator end) {
+	if(K_ == 0 || (full() && score <= worstScore_)) return false;
+	size_t size = end - begin;
+	if(size > width_)
+	  throw std::runtime_error("pattern larger than the top-k arena");
+	Entry entry{score, nInserted_++, size, nullptr};
+	if(full()) {
+	  std::pop_heap(heap_.begin(), heap_.end(), better);
+	  entry.vars_ = heap_.back().vars_;
+	  heap_.back() = entry;
+	} else {
+	  entry.vars_ = arena_.data() + heap_.size() * width_;
+	  heap_.push_back(entry);
+	}
+	std::copy(begin, end, entry.vars_);
+	std::push_heap(heap_.begin(), heap_.end(), better);
+	// Pruning only starts once the top-k heap is full
+	if(full())
+	  worstScore_ = heap_.front().score_;
+	return true;
+      }
+
+      void merge(const TopKHeap& other) {
+	for(const Entry& entry : other.sorted())
+	  insert(entry.score_, entry.vars_, entry.vars_ + entry.size_);
+      }
+
+      // Entries from the worst to the best
+      std::vector<Entry> sorted() const {
+	std::vector<Entry> entries(heap_);
+	std::sort(entries.begin(), entries.end(), [](const Entry& e1, const Entry& e2) { return better(e2, e1); });
+	return entries;
+      }
+      
+      std::vector<std::pair<double, pattern_type>> patterns() const {
+	std::vector<std::pair<double, pattern_type>> res;
+	for(const Entry& entry : sorted())
+	  res.emplace_back(entry.score_, pattern_type(entry.vars_, entry.vars_ + entry.size_));
+	return res;
+      }
+    };
+    
+    // Best patterns scored by the workers of the search, each into its own heap. The largest worst score
+    // of the full heaps is a lower bound of the worst score of the top-k patterns: it is published
+    // atomically so that every worker prunes with it, and the heaps are merged once the search is over or
+    // for a snapshot, each heap being locked by its worker while it inserts a pattern.
+    class IFPGrowth::TopK {
+      using pattern_type = std::vector<attribute_type>;
+      
+      size_t K_, width_;
+      std::vector<TopKHeap> heaps_;
+      mutable std::unique_ptr<std::mutex[]> locks_;
+      std::atomic<double> worstScore_;
+      std::atomic<unsigned int> nPatterns_;
+      std::atomic<bool> stopped_;
+      std::function<void(double, const pattern_type&)> stream_;
+
+    public:
+      TopK(size_t K, size_t width, size_t nWorkers, const std::vector<std::pair<double, pattern_type>>& patterns, unsigned int nPatterns) :
+	K_(K), width_(width), heaps_(), locks_(new std::mutex[nWorkers]),
+	worstScore_(-std::numeric_limits<double>::max()), nPatterns_(nPatterns), stopped_(false) {
+	heaps_.reserve(nWorkers);
+	for(size_t w = 0; w != nWorkers; ++w)
+	  heaps_.emplace_back(K, width);
+	for(const auto& pattern : patterns)
+	  heaps_.front().insert(pattern.first, pattern.second.begin(), pattern.second.end());
+	worstScore_ = heaps_.front().worstScore();
+      }
+
+      // Pass every pattern scored above minScore to stream instead of keeping the best ones
+      void stream(double minScore, const std::function<void(double, const pattern_type&)>& stream) {
+	worstScore_ = minScore;
+	stream_ = stream;
+      }
+
+      double worstScore() const { return worstScore_.load(std::memory_order_relaxed); }
+
+      void insert(size_t worker, double score, const pattern_type& pattern) {
+	nPatterns_.fetch_add(1, std::memory_order_relaxed);
+	if(score <= worstScore()) return;
+	if(stream_) {
+	  stream_(score, pattern);
+	  return;
+	}
+	TopKHeap& heap = heaps_[worker];
+	std::unique_lock<std::mutex> lock(locks_[worker]);
+	if(heap.insert(score, pattern.begin(), pattern.end()) && heap.full()) {
+	  lock.unlock();
+	  double worst = worstScore();
+	  while(worst < heap.worstScore() && ! worstScore_.compare_exchange_weak(worst, heap.worstScore()));
+	}
+      }
+
+      // Patterns from the worst to the best
+      std::vector<std::pair<double, pattern_type>> patterns() const {
+	if(heaps_.size() == 1) {
+	  std::lock_guard<std::mutex> lock(locks_[0]);
+	  return heaps_.front().patterns();
+	}
+	TopKHeap merged(K_, width_);
+	for(size_t w = 0; w != heaps_.size(); ++w) {
+	  std::lock_guard<std::mutex> lock(locks_[w]);
+	  merged.merge(heaps_[w]);
+	}
+	return merged.patterns();
+      }
+
+      unsigned int nPatterns() const { return nPatterns_; }
+
+      // Make every worker stop at its next step
+      void stop() { stopped_ = true; }
+      bool stopped() const { return stopped_; }
+    };
+    
+    // Output of the patterns, as soon as they are scored when they are not ranked, shared by the searches.
+    // The patterns of several targets start with their target.
+    class IFPGrowth::PatternStream {
       using pattern_type = std::vector<attribute_type>;
       using output_format = tuple<list<attribute_type>, double>;
       using parser_t = JSONParser<flow<output_format>>;
-      using stream_t = output_stream_t<parser_t>;
+      using grouped_format = tuple<attribute_type, list<attribute_type>, double>;
+      using grouped_parser_t = JSONParser<flow<grouped_format>>;
+
+      std::mutex mutex_;
+      std::unique_ptr<output_stream_t<parser_t>> stream_;
+      std::unique_ptr<output_stream_iterator_t<output_stream_t<parser_t>>> it_;
+      std::unique_ptr<output_stream_t<grouped_parser_t>> groupedStream_;
+      std::unique_ptr<output_stream_iterator_t<output_stream_t<grouped_parser_t>>> groupedIt_;
+
+    public:
+      PatternStream(std::ostream& os, bool grouped) {
+	if(grouped) {
+	  groupedStream_.reset(new output_stream_t<grouped_parser_t>{os, grouped_parser_t{}});
+	  groupedIt_.reset(new output_stream_iterator_t<output_stream_t<grouped_parser_t>>{*groupedStream_});
+	} else {
+	  stream_.reset(new output_stream_t<parser_t>{os, parser_t{}});
+	  it_.reset(new output_stream_iterator_t<output_stream_t<parser_t>>{*stream_});
+	}
+      }
+
+      void write(attribute_type target, double score, pattern_type pattern) {
+	std::sort(pattern.begin(), pattern.end());
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(groupedIt_) {
+	  **groupedIt_ = std::make_tuple(target, pattern, score);
+	  ++*groupedIt_;
+	} else {
+	  **it_ = std::make_pair(pattern, score);
+	  ++*it_;
+	}
+      }
+    };
+    
+    // Top-k patterns written to a side file at most once per interval while the search runs, and once it is over
+    class IFPGrowth::Snapshot {
+      const std::string& fileName_;
+      double interval_, startTime_;
+      cool::Timer timer_;
+      double lastTime_;
+      std::mutex mutex_;
+      std::atomic<unsigned int> nSteps_;
+
+    public:
+      // startTime seconds of the search have already elapsed
+      Snapshot(const std::string& fileName, double interval, double startTime) :
+	fileName_(fileName), interval_(interval), startTime_(startTime), timer_(), lastTime_(0.), mutex_(), nSteps_(0) {
+	timer_.start();
+      }
+
+      // Count the steps of a worker and write the top-k patterns if the interval has elapsed since the last write.
+      // Another worker already writing them is not waited for.
+      void update(const TopK& topK, unsigned int nSteps) {
+	nSteps_ += nSteps;
+	std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+	if(lock && timer_.runningLength() - lastTime_ >= interval_)
+	  write(topK);
+      }
+
+      void finish(const TopK& topK) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	write(topK);
+      }
+
+    private:
+      void write(const TopK& topK) {
+	lastTime_ = timer_.runningLength();
+	snapshot_value_type value;
+	std::get<0>(value) = static_cast<double>(std::time(nullptr));
+	std::get<1>(value) = startTime_ + lastTime_;
+	std::get<2>(value) = topK.worstScore();
+	std::get<3>(value) = nSteps_;
+	std::get<4>(value) = topK.nPatterns();
+	auto patterns = topK.patterns();
+	for(auto it = patterns.rbegin(); it != patterns.rend(); ++it) {
+	  std::sort(it->second.begin(), it->second.end());
+	  std::get<5>(value).push_back(*it);
+	}
+	replaceFile(fileName_, [&value](std::ostream& os) {
+	    make_JSON_parser<snapshot_value_type>().write(os, value);
+	    os << std::endl;
+	  });
+      }
+    };
+    
+    class IFPGrowth::PatternProcessor {
+      using pattern_type = std::vector<attribute_type>;
 	
-      size_t K_;
-      stream_t outputDataStream_;
-      output_stream_iterator_t<stream_t> outputIt_;
       pattern_type pattern_;      
-      Stats& stats_;
-      std::multimap<double, pattern_type> queue_;
-      double worstTopKScore_;
+      TopK& topK_;
+      size_t worker_;
+      unsigned int nSteps_;
+      const IFPGrowth& settings_;
+      cool::Timer checkpointTimer_, snapshotTimer_;
+      Snapshot* snapshot_;
+      unsigned int nReportedSteps_;
+      Checkpoint checkpoint_;
+      cool::Timer& timer_;
+      double elapsedTime_;
+
+      void saveCheckpoint(const FPTree::position_type& position) {
+	checkpoint_.position_ = position;
+	checkpoint_.topK_ = topK_.patterns();
+	checkpoint_.nPatterns_ = topK_.nPatterns();
+	checkpoint_.elapsedTime_ = elapsedTime_ + timer_.runningLength();
+	checkpoint_.write(settings_.checkpointFileName_);
+      }
       
     public:
-      PatternProcessor(size_t K, std::ostream& outputStream, Stats& stats) :
-	K_(K),
-	outputDataStream_{outputStream, parser_t{}},	
-	outputIt_{outputDataStream_},
-	stats_(stats),
-	queue_(),
-	worstTopKScore_(-std::numeric_limits<double>::max()) {}
-
-      ~PatternProcessor() {
-	pattern_type pattern;
-	for(auto it = queue_.rbegin(); it != queue_.rend(); ++it) {
-	  pattern = it->second;
-	  std::sort(pattern.begin(), pattern.end());
-	  *outputIt_++ = std::make_pair(pattern, it->first);
-	}
+      PatternProcessor(TopK& topK, size_t worker, const IFPGrowth& settings, const Checkpoint& checkpoint, cool::Timer& timer, double elapsedTime,
+		       Snapshot* snapshot) :
+	topK_(topK),
+	worker_(worker),
+	nSteps_(0),
+	settings_(settings),
+	checkpointTimer_(settings.checkpointFileName_.empty() ? 0. : settings.checkpointInterval_),
+	snapshotTimer_(snapshot ? settings.snapshotInterval_ : 0.),
+	snapshot_(snapshot),
+	nReportedSteps_(0),
+	checkpoint_(checkpoint),
+	timer_(timer),
+	elapsedTime_(elapsedTime) {
+	checkpointTimer_.start();
+	snapshotTimer_.start();
       }
-      
-      double worstTopKScore() { return worstTopKScore_; }
+
+      double worstTopKScore() { return topK_.worstScore(); }
       
       void emit(double score) {
-	bool toInsert = queue_.size() < K_;
-	if(! toInsert) {
-	  toInsert = worstTopKScore_ < score;
-	  if(toInsert)
-	    queue_.erase(queue_.begin());
+	topK_.insert(worker_, score, pattern_);
+      }
+
+      void push(attribute_type var) {
+	pattern_.push_back(var);
+      }
+
+      void pop() {
+	pattern_.pop_back();
+      } 
+
+      unsigned int nSteps() const { return nSteps_; }
+
+      // Count the steps not reported yet to the snapshot
+      void flush() {
+	if(snapshot_)
+	  snapshot_->update(topK_, nSteps_ - nReportedSteps_);
+	nReportedSteps_ = nSteps_;
+      }
+
+      // Called between two search steps: save the search state whenever the checkpoint interval has elapsed
+      // and return false to stop the search once a budget is exhausted, possibly by another worker
+      bool checkpoint(const FPTree::position_type& position) {
+	++nSteps_;
+	bool exhausted = (settings_.timeLimit_ > 0. && std::chrono::steady_clock::now() >= settings_.deadline_)
+	  || topK_.nPatterns() >= settings_.maxPatterns_;
+	if(exhausted)
+	  topK_.stop();
+	exhausted = topK_.stopped();
+	if(! settings_.checkpointFileName_.empty() && (checkpointTimer_.top() || exhausted))
+	  saveCheckpoint(position);
+	if(snapshot_ && snapshotTimer_.top()) {
+	  snapshot_->update(topK_, nSteps_ - nReportedSteps_);
+	  nReportedSteps_ = nSteps_;
 	}
-	if(toInsert) {
-	  queue_.insert(std::make_pair(score, pattern_));
-	  // outputDataStream_ << std::flush;
-	  auto worstTopK = queue_.begin();
-	  worstTopKScore_ = worstTopK->first;
+	return ! exhausted;
+      }
+    };
+
+    // Scores the patterns of a pre-pass into the top-k patterns, without checkpoints,
+    // and keeps the best score of the patterns of every variable
+    class IFPGrowth::SeedProcessor {
+      using pattern_type = std::vector<attribute_type>;
+
+      pattern_type pattern_;
+      TopK& topK_;
+      std::map<attribute_type, double>& bestScores_;
+
+    public:
+      SeedProcessor(TopK& topK, std::map<attribute_type, double>& bestScores) :
+	pattern_(), topK_(topK), bestScores_(bestScores) {}
+
+      void emit(double score) {
+	topK_.insert(0, score, pattern_);
+	for(attribute_type var : pattern_) {
+	  auto it = bestScores_.emplace(var, score).first;
+	  it->second = std::max(it->second, score);
 	}
-	++stats_.nPatterns_;
       }
 
       void push(attribute_type var) {
@@ -71,18 +396,205 @@ namespace gimlet {
 
       void pop() {
 	pattern_.pop_back();
-      } 
+      }
+
+      bool checkpoint(const FPTree::position_type&) {
+	return ! topK_.stopped();
+      }
     };
-    
+
+    void IFPGrowth::Checkpoint::read(const std::string& fileName) {
+      std::ifstream file(fileName, std::ios::in | std::ios::binary);
+      if(! file.good())
+	throw std::runtime_error(std::string("cannot open checkpoint file ") + fileName);
+      checkpoint_value_type value;
+      make_JSON_parser<checkpoint_value_type>().read(file, value);
+      // Checkpoints without the seeded size precede the pre-pass
+      if(! file.good() || (std::get<1>(value).size() != 3 && std::get<1>(value).size() != 4))
+	throw std::runtime_error(std::string("invalid checkpoint file ") + fileName);
+      
+      position_.clear();
+      for(const auto& frame : std::get<0>(value))
+	position_.push_back(FPTree::Frame{frame.first, frame.second});
+      nVars_ = std::get<1>(value)[0];
+      size_ = std::get<1>(value)[1];
+      nbrNodes_ = std::get<1>(value)[2];
+      seeded_ = std::get<1>(value).size() == 4 ? std::get<1>(value)[3] : 0;
+      topK_ = std::move(std::get<2>(value));
+      nPatterns_ = std::get<3>(value);
+      elapsedTime_ = std::get<4>(value);
+    }
+
+    void IFPGrowth::Checkpoint::write(const std::string& fileName) const {
+      checkpoint_value_type value;
+      for(const FPTree::Frame& frame : position_)
+	std::get<0>(value).emplace_back(frame.index_, frame.included_);
+      std::get<1>(value) = { nVars_, size_, nbrNodes_, seeded_ };
+      std::get<2>(value) = topK_;
+      std::get<3>(value) = nPatterns_;
+      std::get<4>(value) = elapsedTime_;
+
+      replaceFile(fileName, [&value](std::ostream& os) {
+	  make_JSON_parser<checkpoint_value_type>().write(os, value);
+	  os << std::endl;
+	});
+    }
+
+    std::vector<std::pair<double, std::vector<attribute_type>>>
+    IFPGrowth::search(int target, const std::vector<std::vector<pair_type>>& data,
+		      size_t K, double alpha, size_t nThreads,
+		      bool resume, const Checkpoint& resumed, cool::Timer& timer,
+		      PatternStream& stream, Measures& measures) const {
+      const size_t nWorkers = std::max<size_t>(1, searchThreads_);
+
+      cool::Timer targetTimer;
+      targetTimer.start();
+
+      // Every worker refines the partitions of its own tree and shares the threads with the other ones
+      std::vector<std::unique_ptr<FPTree>> trees;
+      for(size_t i = 0; i != nWorkers; ++i) {
+	trees.emplace_back(new FPTree(target, std::max<size_t>(1, nThreads / nWorkers), constraints_, engine_));
+	trees.back()->build(data.begin(), data.end());
+	trees.back()->setParallelThreshold(parallelThreshold_);
+	trees.back()->setBiasCache(biasCacheCapacity_);
+	trees.back()->setBiasTolerance(biasTolerance_);
+	trees.back()->setBound(bound_);
+	if(minimal_)
+	  trees.back()->setMinimal(minimalTolerance_);
+      }
+      FPTree& tree = *trees.front();
+      if(resume) {
+	if(resumed.nVars_ != tree.nVars() || resumed.size_ != tree.size() || resumed.nbrNodes_ != tree.nbrNodes())
+	  throw std::runtime_error("checkpoint does not match the input data");
+      }
+      measures.target_ = tree.target();
+      measures.alpha_ = alpha;
+      
+      // tree.internalState(std::clog);
+
+      Checkpoint checkpoint{};
+      checkpoint.nVars_ = tree.nVars();
+      checkpoint.size_ = tree.size();
+      checkpoint.nbrNodes_ = tree.nbrNodes();
+      // A resumed search keeps the pre-pass of the interrupted one
+      checkpoint.seeded_ = resume ? resumed.seeded_ : seed_;
+
+      TopK topK{thresholded_ ? 0 : K, std::min(constraints_.maxSize_, tree.nVars()), nWorkers, resumed.topK_, resumed.nPatterns_};
+      if(thresholded_)
+	topK.stream(minScore_, [&stream, &measures](double score, const std::vector<attribute_type>& pattern) {
+	    stream.write(measures.target_, score, pattern);
+	  });
+      auto selector = [&topK, &alpha](double value) {
+	bool select = value > topK.worstScore() / alpha;
+	// if(! select) std::cerr << "prune" << std::endl;
+	return select;
+      };
+
+      std::map<attribute_type, double> seedScores;
+      if(seed_ && ! resume) {
+	SeedProcessor seeder{topK, seedScores};
+	tree.seed(seeder, selector, seed_);
+      }
+      for(auto& t : trees)
+	t->setSeeded(checkpoint.seeded_);
+      // Without checkpoints, the branches below the empty pattern can be explored in any order.
+      // After a pre-pass, those of the variables of the best seeded patterns are explored first.
+      // Minimal patterns rely on every pattern being scored before its supersets, as in a sequential search.
+      const bool reorder = seed_ && ! resume && checkpointFileName_.empty() && ! minimal_;
+
+      std::unique_ptr<Snapshot> snapshot;
+      if(! snapshotFileName_.empty())
+	snapshot.reset(new Snapshot{snapshotFileName_, snapshotInterval_, resumed.elapsedTime_ + timer.runningLength()});
+
+      measures.nSteps_ = 0;
+      cool::Timer searchTimer;
+      searchTimer.start();
+      if(nWorkers == 1 && ! reorder) {
+	PatternProcessor processor{topK, 0, *this, resume ? resumed : checkpoint, timer, resumed.elapsedTime_, snapshot.get()};
+	tree.generate(processor, selector, resumed.position_);
+	processor.flush();
+	measures.nSteps_ = processor.nSteps();
+      } else {
+	// The workers claim the branches below the empty pattern in the order of a sequential search
+	FPTree::position_type roots = tree.roots();
+	std::reverse(roots.begin(), roots.end());
+	if(reorder) {
+	  auto priority = [&](const FPTree::Frame& frame) {
+	    auto it = seedScores.find(tree.variable(frame.index_));
+	    return it == seedScores.end() ? -std::numeric_limits<double>::max() : it->second;
+	  };
+	  std::stable_sort(roots.begin(), roots.end(), [&](const FPTree::Frame& f1, const FPTree::Frame& f2) {
+	      return priority(f1) > priority(f2);
+	    });
+	}
+	std::atomic<size_t> nextRoot{0};
+	std::atomic<unsigned int> nSteps{0};
+	std::vector<std::exception_ptr> errors(nWorkers);
+	std::vector<std::thread> workers;
+	for(size_t w = 0; w != nWorkers; ++w)
+	  workers.emplace_back([&, w]() {
+	      try {
+		PatternProcessor processor{topK, w, *this, checkpoint, timer, 0., snapshot.get()};
+		for(size_t i = nextRoot++; i < roots.size() && ! topK.stopped(); i = nextRoot++)
+		  trees[w]->generate(processor, selector, FPTree::position_type{roots[i]});
+		processor.flush();
+		nSteps += processor.nSteps();
+	      } catch(...) {
+		errors[w] = std::current_exception();
+		topK.stop();
+	      }
+	    });
+	for(auto& worker : workers) worker.join();
+	for(auto& error : errors)
+	  if(error) std::rethrow_exception(error);
+	measures.nSteps_ = nSteps;
+      }
+      double searchTime = searchTimer.stop();
+      if(snapshot)
+	snapshot->finish(topK);
+      measures.stepRate_ = searchTime > 0. ? measures.nSteps_ / searchTime : 0.;
+      measures.nPatterns_ = topK.nPatterns();
+      measures.truncated_ = topK.stopped();
+      measures.biasHits_ = measures.biasMisses_ = 0;
+      measures.biasError_ = 0.;
+      measures.nBoundPrunings_ = measures.nBiasPrunings_ = 0;
+      measures.nExpanded_ = measures.nRefinedPrunings_ = 0;
+      measures.nDependencies_ = measures.nMinimalPrunings_ = 0;
+      for(const auto& t : trees) {
+	measures.nExpanded_ += t->nExpanded();
+	measures.nDependencies_ += t->nDependencies();
+	measures.nMinimalPrunings_ += t->nMinimalPrunings();
+	measures.nRefinedPrunings_ += t->nRefinedPrunings();
+	measures.nBoundPrunings_ += t->nBoundPrunings();
+	measures.nBiasPrunings_ += t->nBiasPrunings();
+	measures.biasHits_ += t->biasCacheHits();
+	measures.biasMisses_ += t->biasCacheMisses();
+	measures.biasError_ = std::max(measures.biasError_, t->maxBiasError());
+      }
+
+      measures.totalTime_ = targetTimer.stop();
+      return topK.patterns();
+    }
+
     void IFPGrowth::operator()(
-			       int target,
+			       const std::vector<int>& targets,
 			       size_t K,
 			       double alpha,
 			       size_t nThreads,
 			       const std::string& inputFileName,
 			       const std::string& outputFileName,
-			       const std::string& statsFileName
+			       const std::string& statsFileName,
+			       const std::string& resumeFileName
 			       ) {
+      cool::Timer timer;
+      timer.start();
+      Checkpoint resumed{};
+      bool resume = ! resumeFileName.empty();
+      if(resume)
+	resumed.read(resumeFileName);
+      deadline_ = std::chrono::steady_clock::now()
+	+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeLimit_ - resumed.elapsedTime_));
+      
       auto inputStream = std::ref(std::cin);
       std::ifstream inputFile;
       if(! inputFileName.empty()) {
@@ -96,32 +608,174 @@ namespace gimlet {
 	outputStream = outputFile;
       }
       
-      stats_.alpha_ = alpha;
       if(! statsFileName.empty())
 	stats_.open(statsFileName.c_str(), "%");
       
-      cool::Timer timer;
-      timer.start();
+      if(searchThreads_ > 1 && (resume || ! checkpointFileName_.empty()))
+	throw std::runtime_error("checkpoints require a single search thread");
+      if(targets.size() != 1 && (resume || ! checkpointFileName_.empty()))
+	throw std::runtime_error("checkpoints require a single target");
+      if(thresholded_ && (resume || ! checkpointFileName_.empty()))
+	throw std::runtime_error("checkpoints require top-k patterns");
+      // The dependencies found by a search are neither saved nor shared with other workers
+      if(targets.size() != 1 && ! snapshotFileName_.empty())
+	throw std::runtime_error("snapshots require a single target");
+      if(minimal_ && (searchThreads_ > 1 || resume || ! checkpointFileName_.empty()))
+	throw std::runtime_error("minimal patterns require a single search thread without checkpoints");
 
-      FPTree tree(target, nThreads);
-      tree.build(inputStream);
-      
-      // tree.internalState(std::clog);
+      // The rows are parsed once and every target builds its trees from them
+      const std::vector<std::vector<pair_type>> data = FPTree::read(inputStream);
+      std::vector<int> searched = targets;
+      if(searched.empty()) {
+	// Every variable that can be a target
+	std::set<attribute_type> vars;
+	for(const auto& row : data)
+	  for(const pair_type& attr : row)
+	    if(constraints_.excluded_.count(attr.first) == 0 && constraints_.included_.count(attr.first) == 0)
+	      vars.insert(attr.first);
+	searched.assign(vars.begin(), vars.end());
+      }
+      const double readTime = timer.runningLength();
 
-      PatternProcessor processor{K, outputStream, stats_};	
-	
-      auto selector = [&processor, &alpha](double value) {
-	bool select = value > processor.worstTopKScore() / alpha;
-	// if(! select) std::cerr << "prune" << std::endl;
-	return select;
-      };
+      PatternStream stream{outputStream, targets.size() != 1};
+
+      // The searches of several targets run concurrently, sharing the threads
+      const size_t nTargets = searched.size();
+      const size_t nConcurrent = std::max<size_t>(1, std::min(nTargets, nThreads));
+      std::vector<std::vector<std::pair<double, std::vector<attribute_type>>>> patterns(nTargets);
+      std::vector<Measures> measures(nTargets);
+      if(nTargets == 1)
+	patterns.front() = search(searched.front(), data, K, alpha, nThreads, resume, resumed, timer, stream, measures.front());
+      else {
+	std::atomic<size_t> nextTarget{0};
+	std::vector<std::exception_ptr> errors(nTargets);
+	std::vector<std::thread> workers;
+	for(size_t w = 0; w != nConcurrent; ++w)
+	  workers.emplace_back([&]() {
+	      for(size_t i = nextTarget++; i < nTargets; i = nextTarget++) {
+		try {
+		  patterns[i] = search(searched[i], data, K, alpha, std::max<size_t>(1, nThreads / nConcurrent), false, resumed, timer, stream, measures[i]);
+		} catch(...) {
+		  errors[i] = std::current_exception();
+		}
+	      }
+	    });
+	for(auto& worker : workers) worker.join();
+	for(auto& error : errors)
+	  if(error) std::rethrow_exception(error);
+      }
 
-      tree.generate(processor, selector);
+      for(size_t i = 0; i != nTargets; ++i)
+	for(auto it = patterns[i].rbegin(); it != patterns[i].rend(); ++it)
+	  stream.write(measures[i].target_, it->first, it->second);
+      if(! checkpointFileName_.empty() && ! measures.front().truncated_)
+	std::remove(checkpointFileName_.c_str());
       
-      stats_.totalTime_ = timer.stop();
-      stats_.write();
+      for(const Measures& m : measures) {
+	static_cast<Measures&>(stats_) = m;
+	stats_.totalTime_ = resumed.elapsedTime_ + readTime + m.totalTime_;
+	stats_.write();
+      }
+    }
+
+    void IFPGrowth::setCheckpoint(const std::string& fileName, double interval) {
+      checkpointFileName_ = fileName;
+      checkpointInterval_ = interval;
+    }
+
+    void IFPGrowth::setSnapshot(const std::string& fileName, double interval) {
+      snapshotFileName_ = fileName;
+      snapshotInterval_ = interval;
+    }
+
+    void IFPGrowth::setBudget(double timeLimit, size_t maxPatterns) {
+      timeLimit_ = timeLimit;
+      maxPatterns_ = maxPatterns;
+    }
+
+    void IFPGrowth::setConstraints(const FPTree::Constraints& constraints) {
+      constraints_ = constraints;
+    }
+
+    void IFPGrowth::setEngine(FPTree::Engine engine) {
+      engine_ = engine;
+    }
+
+    void IFPGrowth::setParallelThreshold(size_t threshold) {
+      parallelThreshold_ = threshold;
+    }
+
+    void IFPGrowth::setBiasCache(size_t capacity) {
+      biasCacheCapacity_ = capacity;
+    }
+
+    void IFPGrowth::setBiasTolerance(double tolerance) {
+      biasTolerance_ = tolerance;
+    }
+
+    void IFPGrowth::setBound(FPTree::Bound bound) {
+      bound_ = bound;
+    }
+
+    void IFPGrowth::setSeed(size_t size) {
+      seed_ = size;
+    }
+
+    void IFPGrowth::setThreshold(double minScore) {
+      thresholded_ = true;
+      minScore_ = minScore;
+    }
+
+    void IFPGrowth::setMinimal(double tolerance) {
+      minimal_ = true;
+      minimalTolerance_ = tolerance;
+    }
+
+    void IFPGrowth::setSearchThreads(size_t nThreads) {
+      searchThreads_ = nThreads;
+    }
+
+    std::set<attribute_type> IFPGrowth::parseVariables(const std::string& variables) {
+      std::set<attribute_type> res;
+      std::istringstream iss(variables);
+      std::string name;
+      while(std::getline(iss, name, ','))
+	if(! name.empty())
+	  res.insert(static_cast<attribute_type>(std::stoul(name)));
+      return res;
+    }
+
+    std::vector<int> IFPGrowth::parseTargets(const std::string& targets) {
+      std::vector<int> res;
+      if(targets == "all")
+	return res;
+      std::istringstream iss(targets);
+      std::string name;
+      while(std::getline(iss, name, ','))
+	if(! name.empty())
+	  res.push_back(std::stoi(name));
+      if(res.empty())
+	throw std::runtime_error("no target in " + targets);
+      return res;
+    }
+
+    FPTree::Engine IFPGrowth::parseEngine(const std::string& engine) {
+      if(engine == "tree") return FPTree::Engine::tree;
+      if(engine == "bitmap") return FPTree::Engine::bitmap;
+      throw std::runtime_error(std::string("unknown engine ") + engine);
+    }
+
+    FPTree::Bound IFPGrowth::parseBound(const std::string& bound) {
+      if(bound == "bias") return FPTree::Bound::bias;
+      if(bound == "refined") return FPTree::Bound::refined;
+      throw std::runtime_error(std::string("unknown bound ") + bound);
     }
 
-    IFPGrowth::IFPGrowth() : stats_{} {}
+    IFPGrowth::IFPGrowth() : stats_{}, checkpointFileName_(), checkpointInterval_(0.),
+			     snapshotFileName_(), snapshotInterval_(0.),
+			     timeLimit_(0.), deadline_(), maxPatterns_(std::numeric_limits<size_t>::max()),
+			     constraints_(), engine_(FPTree::Engine::tree), parallelThreshold_(0),
+			     biasCacheCapacity_(0), biasTolerance_(0.), bound_(FPTree::Bound::bias), seed_(0), thresholded_(false), minScore_(0.),
+			     minimal_(false), minimalTolerance_(0.), searchThreads_(1) {}
   }
 }
@@ -1,37 +1,160 @@
 #pragma once
 
+#include <string>
+#include <set>
+#include <chrono>
 #include "gimlet/statistics.hpp"
+#include "gimlet/timer.hpp"
 #include "FPTree.hpp"
 
 namespace gimlet {
   namespace itemsets {
     class IFPGrowth {
       class PatternProcessor;
+      class SeedProcessor;
+      class PatternStream;
+      class Snapshot;
+      class TopKHeap;
+      class TopK;
       
-      struct Stats : cool::Statistics {
+      // Measures of the search of the patterns of one target
+      struct Measures {
 	unsigned int target_;
 	double alpha_;
 	unsigned int nPatterns_;
 	double totalTime_;
-
-	Stats() : Statistics() {
+	unsigned int truncated_;
+	unsigned int nSteps_;
+	double stepRate_;
+	unsigned int biasHits_, biasMisses_;
+	double biasError_;
+	unsigned int nBoundPrunings_, nBiasPrunings_;
+	unsigned int nExpanded_, nRefinedPrunings_;
+	unsigned int nDependencies_, nMinimalPrunings_;
+      };
+      
+      struct Stats : Measures, cool::Statistics {
+	Stats() : Measures(), Statistics() {
 	  addInteger("target", target_);
 	  addDouble("alpha", alpha_);
 	  addDouble("total time", totalTime_, "s");
 	  addInteger("patterns", nPatterns_);
+	  addInteger("truncated", truncated_);
+	  addInteger("steps", nSteps_);
+	  addDouble("step rate", stepRate_, "steps/s");
+	  addInteger("bias cache hits", biasHits_);
+	  addInteger("bias cache misses", biasMisses_);
+	  addDouble("bias error", biasError_);
+	  addInteger("bound prunings", nBoundPrunings_);
+	  addInteger("bias prunings", nBiasPrunings_);
+	  addInteger("expanded patterns", nExpanded_);
+	  addInteger("refined prunings", nRefinedPrunings_);
+	  addInteger("dependencies", nDependencies_);
+	  addInteger("minimal prunings", nMinimalPrunings_);
 	}
       };
       
+      // State of an interrupted search from which it can be resumed
+      struct Checkpoint {
+	FPTree::position_type position_;
+	size_t nVars_, size_, nbrNodes_;
+	size_t seeded_;
+	std::vector<std::pair<double, std::vector<attribute_type>>> topK_;
+	unsigned int nPatterns_;
+	double elapsedTime_;
+
+	void read(const std::string& fileName);
+	void write(const std::string& fileName) const;
+      };
+      
       Stats stats_;
+      std::string checkpointFileName_;
+      double checkpointInterval_;
+      std::string snapshotFileName_;
+      double snapshotInterval_;
+      double timeLimit_;
+      std::chrono::steady_clock::time_point deadline_; // end of the time limit, counting the time of the resumed runs
+      size_t maxPatterns_;
+      FPTree::Constraints constraints_;
+      FPTree::Engine engine_;
+      size_t parallelThreshold_;
+      size_t biasCacheCapacity_;
+      double biasTolerance_;
+      FPTree::Bound bound_;
+      size_t seed_;
+      bool thresholded_;
+      double minScore_;
+      bool minimal_;
+      double minimalTolerance_;
+      size_t searchThreads_;
+      
+      // Top-k patterns of the target, from the worst to the best, mined from the rows on trees of their own
+      std::vector<std::pair<double, std::vector<attribute_type>>>
+      search(int target, const std::vector<std::vector<FPTree::pair_type>>& data,
+	     size_t K, double alpha, size_t nThreads,
+	     bool resume, const Checkpoint& resumed, cool::Timer& timer,
+	     PatternStream& stream, Measures& measures) const;
       
     public:
-      void operator()(int target,
+      // Mine the top-k patterns of every target, or of every variable that can be one if targets is empty
+      void operator()(const std::vector<int>& targets,
 		      size_t K,
 		      double alpha,
 		      size_t nThreads,
 		      const std::string& inputFileName,
 		      const std::string& outputFileName,
-		      const std::string& statsFileName);
+		      const std::string& statsFileName,
+		      const std::string& resumeFileName);
+
+      // Periodically save the search state every interval seconds into the given file
+      void setCheckpoint(const std::string& fileName, double interval);
+
+      // Write the top-k patterns found so far into the given file every interval seconds and at the end
+      void setSnapshot(const std::string& fileName, double interval);
+
+      // Stop the search once timeLimit seconds have elapsed since the start of the run, resumed runs included
+      // (0 for no limit), or maxPatterns patterns are scored
+      void setBudget(double timeLimit, size_t maxPatterns);
+
+      // Restrict the enumerated patterns to those satisfying the given constraints
+      void setConstraints(const FPTree::Constraints& constraints);
+
+      // Select the data structure on which partitions are refined
+      void setEngine(FPTree::Engine engine);
+
+      // Skip the groups of at least threshold nodes on the whole team of threads, the others on the calling thread
+      void setParallelThreshold(size_t threshold);
+
+      // Cache up to capacity bias terms shared by every search step (0 to disable)
+      void setBiasCache(size_t capacity);
+
+      // Allow an error of at most tolerance on every term of the bias (0 for exact terms)
+      void setBiasTolerance(double tolerance);
+
+      // Select the upper bound of the scores of supersets by which the search is pruned
+      void setBound(FPTree::Bound bound);
+
+      // Score the patterns of at most size variables before the search (0 for none), to fill the top-k
+      // patterns early, and visit first the branches of the variables of the best of them
+      void setSeed(size_t size);
+
+      // Output every pattern scored above minScore as soon as it is found instead of the top-k patterns,
+      // pruning with minScore from the start
+      void setThreshold(double minScore);
+
+      // Only output the minimal patterns among those whose fraction of information is at least 1 - tolerance,
+      // pruning their supersets
+      void setMinimal(double tolerance);
+
+      // Distribute the branches of the search among nThreads workers, each with its own copy of the tree,
+      // pruning with the worst score of the top-k patterns shared by all of them
+      void setSearchThreads(size_t nThreads);
+
+      static std::set<attribute_type> parseVariables(const std::string& variables);
+      static FPTree::Engine parseEngine(const std::string& engine);
+      static FPTree::Bound parseBound(const std::string& bound);
+      // Comma separated targets, or all for every variable (as an empty list)
+      static std::vector<int> parseTargets(const std::string& targets);
 
       IFPGrowth();
     };
@@ -1,6 +1,7 @@
 #include <boost/program_options.hpp>
 #include <iostream>
 #include <thread>
+#include <limits>
 
 #include "IFPGrowth.hpp"
 
@@ -8,7 +9,10 @@ int main(int argc, char *argv[]) {
   using namespace gimlet::itemsets;
   try {
     IFPGrowth ifpgrowth;
-    std::string inputFileName, outputFileName, statsFileName;
+    FPTree::Constraints constraints;
+    std::string inputFileName, outputFileName, statsFileName, checkpointFileName, resumeFileName, snapshotFileName, included, excluded, engine, bound, targets;
+    double checkpointInterval, snapshotInterval, timeLimit, biasTolerance, minScore, minimalTolerance;
+    size_t maxPatterns, parallelThreshold, biasCache, seed, searchThreads;
     int target;
     size_t K;
     double alpha;
@@ -19,13 +23,34 @@ int main(int argc, char *argv[]) {
       po::options_description desc("Allowed options");
       desc.add_options()
 	("help", "help message")
-	("target", po::value<int>(&target)->required(), "target attribute (negative target starts from the end: -1 is the last attribute)")
+	("target", po::value<int>(&target), "target attribute (negative target starts from the end: -1 is the last attribute)")
+	("targets", po::value<std::string>(&targets), "comma separated list of target attributes, or all, whose patterns are mined in a single run and grouped by target in the output")
 	("K", po::value<size_t>(&K)->default_value(1), "number K of top-k patterns")
+	("min-score", po::value<double>(&minScore), "output every pattern whose reliable fraction of information exceeds this score, as soon as it is found, instead of the top-k patterns")
 	("alpha", po::value<double>(&alpha)->default_value(1.), "branch & bound alpha relaxation coefficient")
 	("threads", po::value<size_t>(&nThreads), "number of threads")
 	("input", po::value<std::string>(&inputFileName), "input filename")
 	("output", po::value<std::string>(&outputFileName), "output filename")
-	("stats", po::value<std::string>(&statsFileName), "statistics filename");
+	("stats", po::value<std::string>(&statsFileName), "statistics filename")
+	("checkpoint", po::value<std::string>(&checkpointFileName), "checkpoint filename where the search state is periodically saved")
+	("checkpoint-interval", po::value<double>(&checkpointInterval)->default_value(600.), "time interval in seconds between two checkpoints")
+	("resume", po::value<std::string>(&resumeFileName), "checkpoint filename from which an interrupted search is resumed")
+	("snapshot", po::value<std::string>(&snapshotFileName), "file periodically replaced with the top-k patterns found so far, the time, the worst top-k score and the number of search steps")
+	("snapshot-interval", po::value<double>(&snapshotInterval)->default_value(60.), "time interval in seconds between two snapshots")
+	("time-limit", po::value<double>(&timeLimit)->default_value(0.), "time limit in seconds from the start of the run, resumed runs included, after which the search stops with the current top-k patterns (0 for no limit)")
+	("max-patterns", po::value<size_t>(&maxPatterns)->default_value(std::numeric_limits<size_t>::max(), "none"), "number of scored patterns after which the search stops")
+	("include", po::value<std::string>(&included), "comma separated list of variables every pattern must contain")
+	("exclude", po::value<std::string>(&excluded), "comma separated list of variables removed from the data")
+	("min-size", po::value<size_t>(&constraints.minSize_), "minimum number of variables of patterns")
+	("max-size", po::value<size_t>(&constraints.maxSize_), "maximum number of variables of patterns")
+	("engine", po::value<std::string>(&engine)->default_value("tree"), "data structure on which partitions are refined (tree: FP-tree, bitmap: bitmaps of rows, for small datasets)")
+	("parallel-threshold", po::value<size_t>(&parallelThreshold)->default_value(4096), "number of nodes of a variable below which its levels are skipped by a single thread")
+	("bias-cache", po::value<size_t>(&biasCache)->default_value(1 << 20), "number of bias terms cached across the search steps (0 to disable)")
+	("bias-tolerance", po::value<double>(&biasTolerance)->default_value(0.), "error allowed on every term of the bias, whose sums are truncated around their mode (0 for exact terms)")
+	("bound", po::value<std::string>(&bound)->default_value("bias"), "upper bound of the scores of supersets by which branches are pruned (bias: 1 - bias of the pattern, refined: also 1 - bias of the pattern refined by the target)")
+	("seed", po::value<size_t>(&seed)->default_value(0), "size up to which patterns are scored before the search to fill the top-k patterns early (0: none, 1: single variables, 2: also pairs)")
+	("minimal", po::value<double>(&minimalTolerance)->implicit_value(0.), "only output minimal patterns among those whose fraction of information is at least 1 minus the given tolerance (0 by default: exact dependencies), pruning their supersets")
+	("search-threads", po::value<size_t>(&searchThreads)->default_value(1), "number of workers exploring the branches of the search in parallel, each on its own copy of the tree (without checkpoints)");
 
       po::variables_map vm;
       po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
@@ -34,8 +59,29 @@ int main(int argc, char *argv[]) {
 	return EXIT_FAILURE;
       }
       po::notify(vm);
+      if(vm.count("target") + vm.count("targets") != 1)
+	throw std::runtime_error("exactly one of --target and --targets is required");
+      if(vm.count("target"))
+	targets = std::to_string(target);
+      if(vm.count("min-score"))
+	ifpgrowth.setThreshold(minScore);
+      if(vm.count("minimal"))
+	ifpgrowth.setMinimal(minimalTolerance);
     }
-    ifpgrowth(target, K, alpha, nThreads, inputFileName, outputFileName, statsFileName);
+    ifpgrowth.setCheckpoint(checkpointFileName, checkpointInterval);
+    ifpgrowth.setSnapshot(snapshotFileName, snapshotInterval);
+    ifpgrowth.setBudget(timeLimit, maxPatterns);
+    constraints.included_ = IFPGrowth::parseVariables(included);
+    constraints.excluded_ = IFPGrowth::parseVariables(excluded);
+    ifpgrowth.setConstraints(constraints);
+    ifpgrowth.setEngine(IFPGrowth::parseEngine(engine));
+    ifpgrowth.setParallelThreshold(parallelThreshold);
+    ifpgrowth.setBiasCache(biasCache);
+    ifpgrowth.setBiasTolerance(biasTolerance);
+    ifpgrowth.setBound(IFPGrowth::parseBound(bound));
+    ifpgrowth.setSeed(seed);
+    ifpgrowth.setSearchThreads(searchThreads);
+    ifpgrowth(IFPGrowth::parseTargets(targets), K, alpha, nThreads, inputFileName, outputFileName, statsFileName, resumeFileName);
     return EXIT_SUCCESS;
   } catch(const std::exception& ex) {
     std::cerr << "Error: " << ex.what() << std::endl;
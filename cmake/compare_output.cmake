@@ -0,0 +1,12 @@
+# Runs PROGRAM with ARGS and the INPUT dataset, then checks that its output is the EXPECTED file
+separate_arguments(ARGS)
+execute_process(COMMAND ${PROGRAM} ${ARGS} --input ${INPUT} --output ${OUTPUT} RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "${PROGRAM} failed: ${result}")
+endif()
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${OUTPUT} ${EXPECTED} RESULT_VARIABLE different)
+if(different)
+  file(READ ${OUTPUT} output)
+  file(READ ${EXPECTED} expected)
+  message(FATAL_ERROR "output:\n${output}\nexpected:\n${expected}")
+endif()
@@ -113,16 +113,19 @@ namespace gimlet {
 
     std::ostream* os_;
 
-    void initOutputStream() {
+    void initOutputStream(bool resume) {
       initDataStreams();
-      this->writeBegin(*os_);
+      if(resume)
+	this->writeResume(*os_);
+      else
+	this->writeBegin(*os_);
     }
 
   public:
     OutputDataStream() = default;
-    OutputDataStream(std::ostream& os, const Parser& parser = Parser()) :
+    OutputDataStream(std::ostream& os, const Parser& parser = Parser(), bool resume = false) :
       Parser(parser), os_(&os) {
-      initOutputStream();
+      initOutputStream(resume);
     }
     OutputDataStream(const OutputDataStream& other) = delete;
     OutputDataStream(OutputDataStream&& other) : Parser(std::move(other)), os_(other.os_) {
@@ -37,6 +37,7 @@ namespace gimlet {
     bool finished() const { return true; }
     void readBegin(std::istream&) const {}
     void writeBegin(std::ostream&) const {}
+    void writeResume(std::ostream&) const {}
     void readEnd(std::istream&) const {}
     void writeEnd(std::ostream&) const {}
   };
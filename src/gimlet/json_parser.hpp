@@ -329,6 +329,11 @@ namespace gimlet {
     void writeBegin(std::ostream& os) const {
       os << tabs(this->tabs_) << "[\n";
     }
+
+    // Continue a flow whose beginning and first elements have already been written
+    void writeResume(std::ostream&) const {
+      first_ = false;
+    }
     
     void writeEnd(std::ostream& os) const {
       if(! finished_) {
@@ -8,6 +8,7 @@
 #include <deque>
 #include <iostream>
 #include <chrono>
+#include <atomic>
 
 namespace cool {
 
@@ -50,6 +51,40 @@ namespace cool {
     void join();
   };
 
+  // Team of threads running parallel loops one after the other. Between two loops the workers spin
+  // a while before sleeping, and the caller waits for the end of a loop on a spinning barrier, so that
+  // loops started in quick succession avoid the mutex and condition variable round-trips of a pool.
+  class ParallelTeam {
+    std::vector<std::thread> threads_;
+    void (*invoke_)(const void*, size_t);
+    const void* body_;
+    size_t n_;
+    std::atomic<size_t> next_;        // next index of the current loop to claim
+    std::atomic<unsigned int> generation_, pending_, sleeping_;
+    std::atomic<bool> end_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+
+    void work();
+    void start();
+    
+  public:
+    // The calling thread takes part in the loops besides the nThreads - 1 workers
+    ParallelTeam(size_t nThreads);
+    ~ParallelTeam();
+
+    inline size_t size() const { return threads_.size() + 1; }
+
+    // Run body(i) for every i from 0 to n - 1 and wait for the end of the loop
+    template<typename Body>
+    void operator()(size_t n, const Body& body) {
+      invoke_ = [](const void* body, size_t i) { (*static_cast<const Body*>(body))(i); };
+      body_ = &body;
+      n_ = n;
+      start();
+    }
+  };
+
   inline double timeInMicroSeconds() {
     static auto start = std::chrono::high_resolution_clock::now();
     auto t = std::chrono::high_resolution_clock::now();
@@ -44,4 +44,60 @@ namespace cool {
     while(! tasks_.empty() || running_ > 0)
       idle_.wait(lock);
   }
+
+  ParallelTeam::ParallelTeam(size_t nThreads) :
+    threads_{}, invoke_{}, body_{}, n_{0}, next_{0},
+    generation_{0}, pending_{0}, sleeping_{0}, end_{false}, mutex_{}, wake_{} {
+      while(nThreads-- > 1)
+	threads_.emplace_back([this] () { work(); });
+    }
+
+  ParallelTeam::~ParallelTeam() {
+    end_ = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++generation_;
+    }
+    wake_.notify_all();
+    for(auto& thread : threads_) thread.join();
+  }
+
+  void ParallelTeam::work() {
+    static constexpr unsigned int nSpins = 1 << 14;
+    unsigned int generation = 0;
+    while(true) {
+      for(unsigned int spin = 0; generation_ == generation && spin != nSpins; ++spin)
+	std::this_thread::yield();
+      if(generation_ == generation) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	++sleeping_;
+	wake_.wait(lock, [this, generation] () { return generation_ != generation; });
+	--sleeping_;
+      }
+      generation = generation_;
+      if(end_) break;
+      for(size_t i = next_++; i < n_; i = next_++)
+	invoke_(body_, i);
+      --pending_;
+    }
+  }
+
+  void ParallelTeam::start() {
+    if(threads_.empty() || n_ < 2) {
+      for(size_t i = 0; i != n_; ++i)
+	invoke_(body_, i);
+      return;
+    }
+    next_ = 0;
+    pending_ = threads_.size();
+    ++generation_;
+    if(sleeping_ != 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_.notify_all();
+    }
+    for(size_t i = next_++; i < n_; i = next_++)
+      invoke_(body_, i);
+    while(pending_ != 0)
+      std::this_thread::yield();
+  }
 }